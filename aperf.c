@@ -0,0 +1,182 @@
+#include "aperf.h"
+#include "msr.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct aperf_cpu_ext_t {
+	int fd_msr;
+	bool started;
+	uint64_t aperf;
+	uint64_t mperf;
+	uint64_t tsc;
+};
+
+struct aperf_full_t {
+	struct aperf_t parent;
+	struct array_t * exts;
+};
+
+void aperf_free(struct aperf_t * aperf) {
+	if (aperf) {
+		struct aperf_full_t * full = (struct aperf_full_t *) aperf;
+		if (full->parent.cpus) {
+			array_free(full->parent.cpus);
+		}
+		if (full->exts) {
+			array_free(full->exts);
+		}
+		free(full);
+	}
+}
+
+struct aperf_t * aperf_init(struct topology_t * topology,
+	struct filter_t * filter, bool verbose) {
+	struct aperf_full_t * full;
+	bool filtered = false;
+	char buf[20];
+	int i;
+
+	full = malloc(sizeof(struct aperf_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.cpus = array_new(sizeof(struct aperf_cpu_t), NULL);
+	full->exts = array_new(sizeof(struct aperf_cpu_ext_t), NULL);
+	if (!full->parent.cpus || !full->exts) {
+		aperf_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.base_frequency = 0;
+	full->parent.single_core_busy = 0;
+	full->parent.multi_core_busy = 0;
+	full->parent.single_core_frequency = 0;
+	full->parent.multi_core_frequency = 0;
+
+	for (i = 0; topology && i < topology->cpus->count; i++) {
+		struct topology_cpu_t * topology_cpu = array_get(topology->cpus, i);
+		struct aperf_cpu_t * cpu;
+		struct aperf_cpu_ext_t * ext;
+		uint64_t value;
+		bool selected;
+		int length;
+		int fd;
+
+		/* the CPU is sampled when its frequency or busy ratio is selected */
+		length = sprintf(buf, "CPU %d", topology_cpu->cpu);
+		selected = filter_match(filter, buf);
+		if (!selected) {
+			strcpy(&buf[length], " busy");
+			selected = filter_match(filter, buf);
+		}
+		if (!selected) {
+			filtered = true;
+			continue;
+		}
+		fd = topology_msr(topology_cpu);
+		if (fd < 0 || !msr_rd(fd, MSR_ADDR_APERF, value)) {
+			continue;
+		}
+		if (full->parent.base_frequency == 0 &&
+			msr_rd(fd, MSR_ADDR_PLATFORM_INFO, value)) {
+			/* maximum non-turbo ratio in 100 MHz units */
+			full->parent.base_frequency = ((value >> 8) & 0xff) * 100;
+		}
+		cpu = array_add(full->parent.cpus);
+		ext = cpu ? array_add(full->exts) : NULL;
+		if (!ext) {
+			aperf_free(&full->parent);
+			fprintf(stderr, "No enough memory\n");
+			return NULL;
+		}
+		cpu->cpu = topology_cpu->cpu;
+		cpu->frequency = NAN;
+		cpu->busy = NAN;
+		ext->fd_msr = fd;
+		ext->started = false;
+	}
+
+	if (full->parent.cpus->count == 0) {
+		aperf_free(&full->parent);
+		if (verbose && !filtered) {
+			fprintf(stderr, "Failed to read APERF MSR\n");
+		}
+		return NULL;
+	}
+	array_shrink(full->parent.cpus);
+	array_shrink(full->exts);
+	return &full->parent;
+}
+
+void aperf_measure(struct aperf_t * aperf) {
+	if (aperf) {
+		struct aperf_full_t * full = (struct aperf_full_t *) aperf;
+		float single_core_busy = 0;
+		float multi_core_busy = 0;
+		float single_core_frequency = 0;
+		float multi_core_frequency = 0;
+		int busy_count = 0;
+		int frequency_count = 0;
+		int i;
+
+		for (i = 0; i < full->parent.cpus->count; i++) {
+			struct aperf_cpu_t * cpu = array_get(full->parent.cpus, i);
+			struct aperf_cpu_ext_t * ext = array_get(full->exts, i);
+			uint64_t aperf_value;
+			uint64_t mperf_value;
+			uint64_t tsc_value;
+
+			if (!msr_rd(ext->fd_msr, MSR_ADDR_APERF, aperf_value) ||
+				!msr_rd(ext->fd_msr, MSR_ADDR_MPERF, mperf_value) ||
+				!msr_rd(ext->fd_msr, MSR_ADDR_TSC, tsc_value)) {
+				cpu->frequency = NAN;
+				cpu->busy = NAN;
+				ext->started = false;
+				continue;
+			}
+			if (ext->started) {
+				/* unsigned subtraction handles the wraparound */
+				uint64_t aperf_delta = aperf_value - ext->aperf;
+				uint64_t mperf_delta = mperf_value - ext->mperf;
+				uint64_t tsc_delta = tsc_value - ext->tsc;
+
+				/* MPERF ticks at TSC rate while CPU is in C0 */
+				cpu->busy = tsc_delta > 0 ? (double) mperf_delta / tsc_delta : NAN;
+				if (cpu->busy > 1) {
+					cpu->busy = 1;
+				}
+				cpu->frequency = mperf_delta > 0 && full->parent.base_frequency > 0
+					? full->parent.base_frequency * aperf_delta / mperf_delta : NAN;
+
+				if (!isnan(cpu->busy)) {
+					single_core_busy = cpu->busy > single_core_busy
+						? cpu->busy : single_core_busy;
+					multi_core_busy += cpu->busy;
+					busy_count++;
+				}
+				if (!isnan(cpu->frequency)) {
+					single_core_frequency = cpu->frequency > single_core_frequency
+						? cpu->frequency : single_core_frequency;
+					multi_core_frequency += cpu->frequency;
+					frequency_count++;
+				}
+			}
+			ext->started = true;
+			ext->aperf = aperf_value;
+			ext->mperf = mperf_value;
+			ext->tsc = tsc_value;
+		}
+
+		full->parent.single_core_busy = single_core_busy;
+		full->parent.multi_core_busy = busy_count > 0
+			? multi_core_busy / busy_count : 0;
+		full->parent.single_core_frequency = single_core_frequency;
+		full->parent.multi_core_frequency = frequency_count > 0
+			? multi_core_frequency / frequency_count : 0;
+	}
+}
@@ -0,0 +1,31 @@
+#ifndef __APERF_H__
+#define __APERF_H__
+
+#include "filter.h"
+#include "topology.h"
+#include "util.h"
+
+struct aperf_cpu_t {
+	int cpu;
+	float frequency;
+	float busy;
+};
+
+/* Frequency in MHz is averaged over the time CPU was busy, busy ratio is
+ * a fraction of the interval between measurements. Single core values are
+ * the maximum across CPUs, multi core values are the average. */
+struct aperf_t {
+	struct array_t * cpus;
+	float base_frequency;
+	float single_core_busy;
+	float multi_core_busy;
+	float single_core_frequency;
+	float multi_core_frequency;
+};
+
+struct aperf_t * aperf_init(struct topology_t * topology,
+	struct filter_t * filter, bool verbose);
+void aperf_measure(struct aperf_t * aperf);
+void aperf_free(struct aperf_t * aperf);
+
+#endif
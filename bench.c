@@ -0,0 +1,352 @@
+#include "aperf.h"
+#include "bench.h"
+#include "power.h"
+#include "sensor.h"
+#include "stat.h"
+#include "therm.h"
+#include "topology.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUFSZ 80
+
+/* keeps the compiler from dropping parsed values */
+static volatile int64_t bench_sink;
+
+static void path_free(void * pointer) {
+	free(*(char **) pointer);
+}
+
+static bool paths_add(struct array_t * paths, const char * path) {
+	char ** item;
+	char * copy;
+
+	if (access(path, F_OK) != 0) {
+		return true;
+	}
+	copy = malloc(strlen(path) + 1);
+	if (!copy) {
+		return false;
+	}
+	strcpy(copy, path);
+	item = array_add(paths);
+	if (!item) {
+		free(copy);
+		return false;
+	}
+	*item = copy;
+	return true;
+}
+
+static bool get_powercap_paths(struct array_t * paths, UNUSED int cpus) {
+	char path[PATH_MAX];
+	struct dirent * dirent;
+	DIR * dir;
+	bool success = true;
+
+	snprintf(path, sizeof(path), "%s" DIR_POWERCAP, get_root());
+	dir = opendir(path);
+	if (dir) {
+		while (success && (dirent = readdir(dir))) {
+			if (strstr(dirent->d_name, ":")) {
+				snprintf(path, sizeof(path), "%s" DIR_POWERCAP "/%s/energy_uj",
+					get_root(), dirent->d_name);
+				success = paths_add(paths, path);
+			}
+		}
+		closedir(dir);
+	}
+	return success;
+}
+
+static bool get_hwmon_paths(struct array_t * paths, UNUSED int cpus) {
+	char path[PATH_MAX];
+	char hdir[BUFSZ];
+	int i, j;
+
+	for (i = 0; sensors_find_hwmon("coretemp", hdir, i); i++) {
+		for (j = 1;; j++) {
+			snprintf(path, sizeof(path), "%s" DIR_HWMON "/%s/temp%d_input",
+				get_root(), hdir, j);
+			if (access(path, F_OK) != 0) {
+				break;
+			}
+			if (!paths_add(paths, path)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool get_cpufreq_paths(struct array_t * paths, int cpus) {
+	char path[PATH_MAX];
+	int i;
+
+	for (i = 0; cpus <= 0 || i < cpus; i++) {
+		snprintf(path, sizeof(path), "%s" DIR_CPU_DEVICES
+			"/cpu%d/cpufreq/scaling_cur_freq", get_root(), i);
+		if (access(path, F_OK) != 0) {
+			break;
+		}
+		if (!paths_add(paths, path)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void read_paths(void * data) {
+	struct array_t * paths = data;
+	char buf[BUFSZ];
+	int i;
+
+	for (i = 0; i < paths->count; i++) {
+		char ** path = array_get(paths, i);
+		int fd = open(*path, O_RDONLY);
+		if (fd >= 0) {
+			int size = read(fd, buf, BUFSZ - 1);
+			if (size > 0) {
+				buf[size] = '\0';
+				bench_sink += strtoll(buf, NULL, 10);
+			}
+			close(fd);
+		}
+	}
+}
+
+static void read_sensors(void * data) {
+	sensors_read(data);
+}
+
+static void read_rapl(void * data) {
+	rapl_measure(data);
+}
+
+static void read_therm(void * data) {
+	therm_measure(data);
+}
+
+static void read_aperf(void * data) {
+	aperf_measure(data);
+}
+
+static void read_cpu_stat(void * data) {
+	cpu_stat_measure(data);
+}
+
+/* The parser cpu_stat_measure used before, kept as a baseline: reopens the
+ * file every time and tokenizes it with fscanf. */
+static void read_cpu_stat_fscanf(void * data) {
+	const char * path = data;
+	char buf[BUFSZ];
+	long int value;
+	FILE * file;
+
+	file = fopen(path, "r");
+	if (file) {
+		while (fscanf(file, "%s", buf) == 1 && strstr(buf, "cpu") == buf) {
+			if (strlen(buf) > 3 && atoi(&buf[3]) >= 0) {
+				while (fscanf(file, "%ld", &value) == 1) {
+					bench_sink += value;
+				}
+			} else {
+				int c;
+				while ((c = fgetc(file)) != EOF && c != '\n');
+			}
+		}
+		fclose(file);
+	}
+}
+
+static int compare_ns(const void * a, const void * b) {
+	int64_t x = *(const int64_t *) a;
+	int64_t y = *(const int64_t *) b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void print_unavailable(const char * source) {
+	printf("%-20s %-16s unavailable\n", source, "");
+	fflush(stdout);
+}
+
+static bool bench_run(const char * source, const char * method, int reads,
+	void (* read)(void *), void * data, int iterations) {
+	int64_t * samples = malloc(iterations * sizeof(int64_t));
+	double sum = 0;
+	int i;
+
+	if (!samples) {
+		fprintf(stderr, "No enough memory\n");
+		return false;
+	}
+
+	/* the first reading opens files and primes counters */
+	read(data);
+	for (i = 0; i < iterations; i++) {
+		struct timespec begin;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+		read(data);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+		samples[i] = (int64_t) (end.tv_sec - begin.tv_sec) * 1000000000 +
+			end.tv_nsec - begin.tv_nsec;
+		sum += samples[i];
+	}
+	qsort(samples, iterations, sizeof(int64_t), compare_ns);
+
+#define PERCENTILE(p) ((double) samples[(int) ((iterations - 1) * (p))] / reads)
+	printf("%-20s %-16s %6d %9.0f %9.0f %9.0f %9.0f %9.0f\n", source, method,
+		reads, sum / iterations / reads, PERCENTILE(0.5), PERCENTILE(0.95),
+		PERCENTILE(0.99), (double) samples[iterations - 1] / reads);
+#undef PERCENTILE
+	fflush(stdout);
+
+	free(samples);
+	return true;
+}
+
+/* Compares open/read/close of every file against pread of kept open file
+ * descriptors, and against a single io_uring submission when available. */
+static bool bench_files(const char * source, struct array_t * paths,
+	int iterations) {
+	struct sensors_t * sensors;
+	bool success;
+	int i;
+
+	if (paths->count == 0) {
+		print_unavailable(source);
+		return true;
+	}
+	success = bench_run(source, "open/read/close", paths->count,
+		read_paths, paths, iterations);
+
+	sensors = sensors_init();
+	if (!sensors) {
+		return false;
+	}
+	for (i = 0; i < paths->count; i++) {
+		char ** path = array_get(paths, i);
+		sensors_add(sensors, *path);
+	}
+	if (sensors->count > 0) {
+		sensors_set_batch(sensors, false);
+		success = success && bench_run(source, "pread", sensors->count,
+			read_sensors, sensors, iterations);
+		if (sensors_set_batch(sensors, true)) {
+			success = success && bench_run(source, "io_uring", sensors->count,
+				read_sensors, sensors, iterations);
+		}
+	}
+	sensors_free(sensors);
+	return success;
+}
+
+static bool bench_paths(const char * source,
+	bool (* get)(struct array_t *, int), struct bench_options_t * options) {
+	struct array_t * paths = array_new(sizeof(char *), path_free);
+	bool success;
+
+	if (!paths) {
+		fprintf(stderr, "No enough memory\n");
+		return false;
+	}
+	success = get(paths, options->cpus);
+	if (!success) {
+		fprintf(stderr, "No enough memory\n");
+	}
+	success = success && bench_files(source, paths, options->iterations);
+	array_free(paths);
+	return success;
+}
+
+static bool bench_rapl(struct bench_options_t * options) {
+	struct rapl_t * rapl = rapl_init(RAPL_SOURCE_MSR, NULL);
+	bool success = true;
+
+	if (rapl) {
+		success = bench_run("rapl msr", "pread", rapl->devices->count,
+			read_rapl, rapl, options->iterations);
+		rapl_free(rapl);
+	} else {
+		print_unavailable("rapl msr");
+	}
+	return success;
+}
+
+static bool bench_therm(struct topology_t * topology,
+	struct bench_options_t * options) {
+	struct therm_t * therm = topology ? therm_init(topology, NULL) : NULL;
+	bool success = true;
+
+	if (therm && therm->sensors->count > 0) {
+		success = bench_run("therm msr", "pread", therm->sensors->count,
+			read_therm, therm, options->iterations);
+	} else {
+		print_unavailable("therm msr");
+	}
+	therm_free(therm);
+	return success;
+}
+
+static bool bench_aperf(struct topology_t * topology,
+	struct bench_options_t * options) {
+	struct aperf_t * aperf = topology ? aperf_init(topology, NULL, false)
+		: NULL;
+	bool success = true;
+
+	if (aperf && aperf->cpus->count > 0) {
+		success = bench_run("aperf msr", "pread", aperf->cpus->count,
+			read_aperf, aperf, options->iterations);
+	} else {
+		print_unavailable("aperf msr");
+	}
+	aperf_free(aperf);
+	return success;
+}
+
+static bool bench_cpu_stat(struct bench_options_t * options) {
+	struct cpu_stat_t * cpu_stat = cpu_stat_init();
+	char path[PATH_MAX];
+	bool success = true;
+
+	if (cpu_stat) {
+		snprintf(path, sizeof(path), "%s/proc/stat", get_root());
+		success = bench_run("/proc/stat", "fscanf", 1,
+			read_cpu_stat_fscanf, path, options->iterations) &&
+			bench_run("/proc/stat", "pread", 1,
+			read_cpu_stat, cpu_stat, options->iterations);
+		cpu_stat_free(cpu_stat);
+	} else {
+		print_unavailable("/proc/stat");
+	}
+	return success;
+}
+
+bool bench_mode(struct bench_options_t * options) {
+	struct topology_t * topology;
+	bool success;
+
+	printf("%-20s %-16s %6s %9s %9s %9s %9s %9s\n", "source", "method",
+		"reads", "mean", "p50", "p95", "p99", "max");
+	fflush(stdout);
+
+	topology = topology_init();
+	success = bench_paths("powercap", get_powercap_paths, options) &&
+		bench_rapl(options) &&
+		bench_paths("hwmon", get_hwmon_paths, options) &&
+		bench_therm(topology, options) &&
+		bench_paths("scaling_cur_freq", get_cpufreq_paths, options) &&
+		bench_aperf(topology, options) &&
+		bench_cpu_stat(options);
+	topology_free(topology);
+	return success;
+}
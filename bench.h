@@ -0,0 +1,14 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdbool.h>
+
+struct bench_options_t {
+	int iterations;
+	/* limits the number of CPUs scaling_cur_freq is read from */
+	int cpus;
+};
+
+bool bench_mode(struct bench_options_t * options);
+
+#endif
@@ -1,4 +1,5 @@
 #include "config.h"
+#include "topology.h"
 
 #include <fcntl.h>
 #include <stdio.h>
@@ -8,6 +9,11 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+static void msr_package_free(void * pointer) {
+	struct msr_package_t * package = pointer;
+	close(package->fd_msr);
+}
+
 static void undervolt_free(void * pointer) {
 	struct undervolt_t * undervolt = pointer;
 	free(undervolt->title);
@@ -36,8 +42,8 @@ void free_config(struct config_t * config) {
 		if (config->hwp_hints) {
 			array_free(config->hwp_hints);
 		}
-		if (config->fd_msr >= 0) {
-			close(config->fd_msr);
+		if (config->packages) {
+			array_free(config->packages);
 		}
 		for (i = 0; i < ARRAY_SIZE(config->power); i++) {
 			if (config->power[i].mem) {
@@ -87,12 +93,57 @@ static bool parse_power_limit_value(const char * line,
 	return true;
 }
 
-static bool parse_hwp_load(const char * line, bool * multi, float * threshold,
+/* Parses time in seconds or milliseconds, e.g. 2s, 500ms or 3. */
+static bool parse_time(const char * line, int len, float * value) {
+	char * tmp;
+	float result = strtof(line, &tmp);
+
+	if (tmp == line) {
+		return false;
+	} else if ((int) (tmp - line) != len) {
+		if (strn_eq_const(tmp, "ms", (int) (&line[len] - tmp))) {
+			result /= 1000;
+		} else if (!strn_eq_const(tmp, "s", (int) (&line[len] - tmp))) {
+			return false;
+		}
+	}
+	*value = result;
+	return result > 0;
+}
+
+/* The dwell option is common for all algorithms, it's removed from the line
+ * before the algorithm arguments are parsed. */
+static bool parse_hwp_dwell(char ** line, float * dwell, bool * nl, bool * nll) {
+	char * option = *line ? strrchr(*line, ':') : NULL;
+
+	*dwell = 0;
+	/* the option may be the only argument */
+	option = option ? &option[1] : *line;
+	if (option && strn_eq_const(option, "dwell=", 6)) {
+		if (!parse_time(&option[6], strlen(&option[6]), dwell)) {
+			NEW_LINE(nl, *nll);
+			fprintf(stderr, "Invalid dwell time: %s\n", &option[6]);
+			return false;
+		}
+		if (option == *line) {
+			*line = NULL;
+		} else {
+			option[-1] = '\0';
+		}
+	}
+	return true;
+}
+
+static bool parse_hwp_load(const char * line, const char * algorithm,
+	bool * multi, float * threshold, float * exit_threshold, float * ewma,
 	bool * nl, bool * nll) {
 	int args = 0;
 	bool error = false;
 	bool result_multi;
 	float result_threshold;
+	float result_exit_threshold;
+	bool exit_specified = false;
+	float result_ewma = 0;
 
 	while (line) {
 		int len;
@@ -125,15 +176,35 @@ static bool parse_hwp_load(const char * line, bool * multi, float * threshold,
 					break;
 				}
 			}
+		} else if (args <= 3 && ewma && strn_eq_const(line, "ewma=", 5)) {
+			if (!parse_time(&line[5], len - 5, &result_ewma)) {
+				NEW_LINE(nl, *nll);
+				fprintf(stderr, "Invalid time constant: %.*s\n", len, line);
+				error = true;
+				break;
+			}
+		} else if (args == 2) {
+			/* the hint is switched back below the exit threshold */
+			result_exit_threshold = strtof(line, &tmp);
+			exit_specified = true;
+			if ((tmp && (int) (tmp - line) != len) ||
+				result_exit_threshold > result_threshold) {
+				NEW_LINE(nl, *nll);
+				fprintf(stderr, "Invalid exit threshold: %.*s\n", len, line);
+				error = true;
+				break;
+			}
 		}
 
 		line = line[len] == ':' ? &line[len + 1] : NULL;
 		args++;
 	}
 
-	if (!error && args != 2) {
+	if (!error && args != 2 + (exit_specified ? 1 : 0) +
+		(result_ewma > 0 ? 1 : 0)) {
 		NEW_LINE(nl, *nll);
-		fprintf(stderr, "Wrong number of arguments for 'load' algorithm\n");
+		fprintf(stderr, "Wrong number of arguments for '%s' algorithm\n",
+			algorithm);
 		error = true;
 	}
 
@@ -142,6 +213,86 @@ static bool parse_hwp_load(const char * line, bool * multi, float * threshold,
 	} else {
 		*multi = result_multi;
 		*threshold = result_threshold;
+		*exit_threshold = exit_specified ? result_exit_threshold
+			: result_threshold;
+		if (ewma) {
+			*ewma = result_ewma;
+		}
+		return true;
+	}
+}
+
+static bool parse_hwp_pressure(const char * line,
+	enum hwp_pressure_window * window, float * threshold,
+	float * exit_threshold, bool * nl, bool * nll) {
+	int args = 0;
+	bool error = false;
+	enum hwp_pressure_window result_window;
+	float result_threshold;
+	float result_exit_threshold;
+
+	while (line) {
+		int len;
+		char * tmp = strstr(line, ":");
+		if (tmp) {
+			len = (int) (tmp - line);
+		} else {
+			len = strlen(line);
+		}
+
+		if (args == 0) {
+			if (strn_eq_const(line, "avg10", len)) {
+				result_window = HWP_PRESSURE_WINDOW_AVG10;
+			} else if (strn_eq_const(line, "avg60", len)) {
+				result_window = HWP_PRESSURE_WINDOW_AVG60;
+			} else if (strn_eq_const(line, "avg300", len)) {
+				result_window = HWP_PRESSURE_WINDOW_AVG300;
+			} else if (strn_eq_const(line, "total", len)) {
+				result_window = HWP_PRESSURE_WINDOW_INTERVAL;
+			} else {
+				NEW_LINE(nl, *nll);
+				fprintf(stderr, "Invalid window: %.*s\n", len, line);
+				error = true;
+				break;
+			}
+		} else if (args == 1) {
+			result_threshold = strtof(line, &tmp);
+			if (tmp) {
+				int tmp_len = (int) (tmp - line);
+				if (tmp_len != len) {
+					NEW_LINE(nl, *nll);
+					fprintf(stderr, "Invalid threshold: %.*s\n", len, line);
+					error = true;
+					break;
+				}
+			}
+		} else if (args == 2) {
+			result_exit_threshold = strtof(line, &tmp);
+			if ((tmp && (int) (tmp - line) != len) ||
+				result_exit_threshold > result_threshold) {
+				NEW_LINE(nl, *nll);
+				fprintf(stderr, "Invalid exit threshold: %.*s\n", len, line);
+				error = true;
+				break;
+			}
+		}
+
+		line = line[len] == ':' ? &line[len + 1] : NULL;
+		args++;
+	}
+
+	if (!error && args != 2 && args != 3) {
+		NEW_LINE(nl, *nll);
+		fprintf(stderr, "Wrong number of arguments for 'pressure' algorithm\n");
+		error = true;
+	}
+
+	if (error) {
+		return false;
+	} else {
+		*window = result_window;
+		*threshold = result_threshold;
+		*exit_threshold = args == 3 ? result_exit_threshold : result_threshold;
 		return true;
 	}
 }
@@ -299,6 +450,57 @@ static bool validate_hwp_hint(struct array_t * hwp_hints, bool * nl, bool * nll)
 	return true;
 }
 
+static struct array_t * open_packages(bool * nl, bool * nll) {
+	struct topology_t * topology = topology_init();
+	struct array_t * packages;
+	int i;
+
+	if (!topology) {
+		return NULL;
+	}
+	packages = array_new(sizeof(struct msr_package_t), msr_package_free);
+	if (!packages) {
+		topology_free(topology);
+		NEW_LINE(nl, *nll);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	/* every package has its own voltage, power and temperature controls */
+	for (i = 0; i < topology->cpus->count; i++) {
+		struct topology_cpu_t * cpu = array_get(topology->cpus, i);
+		struct msr_package_t * package;
+		int fd;
+
+		if (!cpu->first_in_package) {
+			continue;
+		}
+		fd = msr_open(cpu->cpu, true);
+		if (fd < 0) {
+			NEW_LINE(nl, *nll);
+			perror("Failed to open MSR device");
+			array_free(packages);
+			packages = NULL;
+			break;
+		}
+		package = array_add(packages);
+		if (!package) {
+			close(fd);
+			NEW_LINE(nl, *nll);
+			fprintf(stderr, "No enough memory\n");
+			array_free(packages);
+			packages = NULL;
+			break;
+		}
+		package->package = cpu->package;
+		package->fd_msr = fd;
+	}
+	topology_free(topology);
+	if (packages) {
+		array_shrink(packages);
+	}
+	return packages;
+}
+
 struct config_t * load_config(struct config_t * old_config, bool * nl) {
 	unsigned int i;
 	bool nll = false;
@@ -321,7 +523,7 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 			perror("No enough memory");
 			return NULL;
 		}
-		config->fd_msr = -1;
+		config->packages = NULL;
 		config->fd_mem = -1;
 	}
 	config->enable = false;
@@ -331,6 +533,8 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 	}
 	config->tjoffset_apply = false;
 	config->hwp_hints = NULL;
+	config->hwp_revalidate = 30000;
+	config->rapl_source = RAPL_SOURCE_AUTO;
 	config->interval = -1;
 	config->daemon_actions = NULL;
 
@@ -355,7 +559,9 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 			"power() { pz power \"$1\" \"$2\" \"$3\"; };"
 			"tjoffset() { pz tjoffset \"$1\"; };"
 			"hwphint() { pz hwphint \"$1\" \"$2\" \"$3\" \"$4\"; };"
+			"rapl() { pz rapl \"$1\"; };"
 			"interval() { pz interval \"$1\"; };"
+			"hwprevalidate() { pz hwprevalidate \"$1\"; };"
 			"daemon() { pz daemon \"$1\"; };"
 			". " SYSCONFDIR "/intel-undervolt.conf",
 			"sh", fdarg, NULL);
@@ -484,8 +690,16 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 				bool force = false;
 				int len;
 				bool load = false;
+				bool busy = false;
+				bool frequency = false;
 				bool load_multi;
 				float load_threshold;
+				float exit_threshold;
+				float load_ewma = 0;
+				float dwell;
+				bool pressure = false;
+				enum hwp_pressure_window pressure_window =
+					HWP_PRESSURE_WINDOW_AVG10;
 				bool power = false;
 				struct array_t * hwp_power_terms = NULL;
 				char * load_hint;
@@ -504,10 +718,35 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 					line[len] = '\0';
 					tmp = &line[len + 1];
 				}
+				if (!parse_hwp_dwell(&tmp, &dwell, nl, &nll)) {
+					error = true;
+					break;
+				}
 				if (!strcmp(line, "load")) {
 					load = true;
-					if (!parse_hwp_load(tmp, &load_multi, &load_threshold,
-						nl, &nll)) {
+					if (!parse_hwp_load(tmp, line, &load_multi, &load_threshold,
+						&exit_threshold, &load_ewma, nl, &nll)) {
+						error = true;
+						break;
+					}
+				} else if (!strcmp(line, "busy")) {
+					busy = true;
+					if (!parse_hwp_load(tmp, line, &load_multi, &load_threshold,
+						&exit_threshold, NULL, nl, &nll)) {
+						error = true;
+						break;
+					}
+				} else if (!strcmp(line, "frequency")) {
+					frequency = true;
+					if (!parse_hwp_load(tmp, line, &load_multi, &load_threshold,
+						&exit_threshold, NULL, nl, &nll)) {
+						error = true;
+						break;
+					}
+				} else if (!strcmp(line, "pressure")) {
+					pressure = true;
+					if (!parse_hwp_pressure(tmp, &pressure_window,
+						&load_threshold, &exit_threshold, nl, &nll)) {
 						error = true;
 						break;
 					}
@@ -554,12 +793,30 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 				}
 				hwp_hint->force = force;
 				hwp_hint->load = load;
+				hwp_hint->busy = busy;
+				hwp_hint->frequency = frequency;
 				hwp_hint->load_multi = load_multi;
 				hwp_hint->load_threshold = load_threshold;
+				hwp_hint->exit_threshold = exit_threshold;
+				hwp_hint->load_ewma = load_ewma;
+				hwp_hint->pressure = pressure;
+				hwp_hint->pressure_window = pressure_window;
 				hwp_hint->power = power;
 				hwp_hint->hwp_power_terms = hwp_power_terms;
+				hwp_hint->dwell = dwell;
 				hwp_hint->load_hint = load_hint;
 				hwp_hint->normal_hint = normal_hint;
+			} else if (!strcmp(line, "rapl")) {
+				iuv_read_line_error();
+				if (!strcmp(line, "auto")) {
+					config->rapl_source = RAPL_SOURCE_AUTO;
+				} else if (!strcmp(line, "sysfs")) {
+					config->rapl_source = RAPL_SOURCE_SYSFS;
+				} else if (!strcmp(line, "msr")) {
+					config->rapl_source = RAPL_SOURCE_MSR;
+				} else {
+					iuv_print_break("Invalid RAPL source: %s\n", line);
+				}
 			} else if (!strcmp(line, "interval")) {
 				int interval;
 				iuv_read_line_error();
@@ -569,6 +826,15 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 					iuv_print_break("Invalid interval: %s\n", line);
 				}
 				config->interval = interval;
+			} else if (!strcmp(line, "hwprevalidate")) {
+				int revalidate;
+				iuv_read_line_error();
+				tmp = NULL;
+				revalidate = (int) strtol(line, &tmp, 10);
+				if (!line[0] || (tmp && tmp[0]) || revalidate < 0) {
+					iuv_print_break("Invalid revalidation interval: %s\n", line);
+				}
+				config->hwp_revalidate = revalidate;
 			} else if (!strcmp(line, "daemon")) {
 				struct daemon_action_t * daemon_action;
 				bool once = false;
@@ -659,45 +925,13 @@ struct config_t * load_config(struct config_t * old_config, bool * nl) {
 
 			if (config->undervolts || need_power_msr ||
 				config->tjoffset_apply) {
-				if (config->fd_msr < 0) {
-#ifdef IS_FREEBSD
-					char * dev = "/dev/cpuctl0";
-#else
-					char * dev = "/dev/cpu/0/msr";
-#endif
-					int fd = open(dev, O_RDWR | O_SYNC);
-					if (fd < 0) {
-						int pid = fork();
-						if (pid < 0) {
-							NEW_LINE(nl, nll);
-							perror("Fork failed");
-						} else if (pid == 0) {
-#ifdef IS_FREEBSD
-							char * executable = "/sbin/kldload";
-							execlp(executable, executable, "cpuctl", NULL);
-#else
-							char * executable = "/sbin/modprobe";
-							execlp(executable, executable, "msr", NULL);
-#endif
-							exit(1);
-						} else {
-							waitpid(pid, &status, 0);
-							if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-								fd = open(dev, O_RDWR | O_SYNC);
-							}
-						}
-					}
-					if (fd >= 0) {
-						config->fd_msr = fd;
-					} else {
-						NEW_LINE(nl, nll);
-						perror("Failed to open MSR device");
-						error = true;
-					}
+				if (!config->packages) {
+					config->packages = open_packages(nl, &nll);
+					error = !config->packages;
 				}
-			} else if (config->fd_msr >= 0) {
-				close(config->fd_msr);
-				config->fd_msr = -1;
+			} else if (config->packages) {
+				array_free(config->packages);
+				config->packages = NULL;
 			}
 		}
 
@@ -1,15 +1,13 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
+#include "msr.h"
+#include "power.h"
 #include "util.h"
 
 #define MAP_SIZE 4096UL
 #define MAP_MASK (MAP_SIZE - 1)
 
-#define MSR_ADDR_TEMPERATURE 0x1a2
-#define MSR_ADDR_UNITS 0x606
-#define MSR_ADDR_VOLTAGE 0x150
-
 struct undervolt_t {
 	int index;
 	char * title;
@@ -46,17 +44,40 @@ struct hwp_power_term_t {
 	double power;
 };
 
+enum hwp_pressure_window {
+	HWP_PRESSURE_WINDOW_AVG10,
+	HWP_PRESSURE_WINDOW_AVG60,
+	HWP_PRESSURE_WINDOW_AVG300,
+	HWP_PRESSURE_WINDOW_INTERVAL
+};
+
 struct hwp_hint_t {
 	bool force;
 	bool load;
+	bool busy;
+	bool frequency;
 	bool load_multi;
 	float load_threshold;
+	/* threshold to switch back to normal hint, same as load_threshold
+	 * when hysteresis is not used */
+	float exit_threshold;
+	/* time constant of load moving average, 0 for raw load */
+	float load_ewma;
+	bool pressure;
+	enum hwp_pressure_window pressure_window;
 	bool power;
 	struct array_t * hwp_power_terms;
+	/* minimum time between hint switches in seconds */
+	float dwell;
 	char * load_hint;
 	char * normal_hint;
 };
 
+struct msr_package_t {
+	int package;
+	int fd_msr;
+};
+
 enum daemon_action_kind {
 	DAEMON_ACTION_KIND_UNDERVOLT,
 	DAEMON_ACTION_KIND_POWER,
@@ -69,7 +90,7 @@ struct daemon_action_t {
 };
 
 struct config_t {
-	int fd_msr;
+	struct array_t * packages;
 	int fd_mem;
 	bool enable;
 	struct array_t * undervolts;
@@ -77,6 +98,8 @@ struct config_t {
 	bool tjoffset_apply;
 	float tjoffset;
 	struct array_t * hwp_hints;
+	int hwp_revalidate;
+	enum rapl_source rapl_source;
 	int interval;
 	struct array_t * daemon_actions;
 };
@@ -0,0 +1,231 @@
+#include "cstate.h"
+#include "msr.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct cstate_tsc_t {
+	int fd_msr;
+	bool valid;
+	uint64_t value;
+	uint64_t delta;
+};
+
+struct cstate_counter_ext_t {
+	int msr_addr;
+	int tsc;
+	bool started;
+	uint64_t last;
+};
+
+struct cstate_full_t {
+	struct cstate_t parent;
+	struct array_t * exts;
+	struct array_t * tscs;
+};
+
+static struct cstate_msr_t {
+	const char * name;
+	int msr_addr;
+} cstate_core_msrs[] = {
+	{ "C3", MSR_ADDR_CORE_C3_RESIDENCY },
+	{ "C6", MSR_ADDR_CORE_C6_RESIDENCY },
+	{ "C7", MSR_ADDR_CORE_C7_RESIDENCY }
+}, cstate_package_msrs[] = {
+	{ "C2", MSR_ADDR_PKG_C2_RESIDENCY },
+	{ "C3", MSR_ADDR_PKG_C3_RESIDENCY },
+	{ "C6", MSR_ADDR_PKG_C6_RESIDENCY },
+	{ "C7", MSR_ADDR_PKG_C7_RESIDENCY },
+	{ "C8", MSR_ADDR_PKG_C8_RESIDENCY },
+	{ "C9", MSR_ADDR_PKG_C9_RESIDENCY },
+	{ "C10", MSR_ADDR_PKG_C10_RESIDENCY }
+};
+
+static void cstate_counter_free(void * pointer) {
+	struct cstate_counter_t * counter = pointer;
+	free(counter->name);
+}
+
+void cstate_free(struct cstate_t * cstate) {
+	if (cstate) {
+		struct cstate_full_t * full = (struct cstate_full_t *) cstate;
+		if (full->parent.counters) {
+			array_free(full->parent.counters);
+		}
+		if (full->exts) {
+			array_free(full->exts);
+		}
+		if (full->tscs) {
+			array_free(full->tscs);
+		}
+		free(full);
+	}
+}
+
+static bool cstate_add_cpu(struct cstate_full_t * full,
+	struct filter_t * filter, int fd, const char * prefix,
+	struct cstate_msr_t * msrs, unsigned int count, bool * discovered) {
+	struct cstate_tsc_t * tsc = NULL;
+	char buf[60];
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		struct cstate_counter_t * counter;
+		struct cstate_counter_ext_t * ext;
+		uint64_t value;
+		int length;
+
+		/* unsupported states fail to read */
+		if (!msr_rd(fd, msrs[i].msr_addr, value)) {
+			continue;
+		}
+		*discovered = true;
+		length = snprintf(buf, sizeof(buf), "%s %s", prefix, msrs[i].name);
+		if (!filter_match(filter, buf)) {
+			continue;
+		}
+		if (!tsc) {
+			tsc = array_add(full->tscs);
+			if (!tsc) {
+				return false;
+			}
+			tsc->fd_msr = fd;
+			tsc->valid = false;
+			tsc->value = 0;
+			tsc->delta = 0;
+		}
+
+		counter = array_add(full->parent.counters);
+		if (!counter) {
+			return false;
+		}
+		counter->name = malloc(length + 1);
+		if (!counter->name) {
+			full->parent.counters->count--;
+			return false;
+		}
+		memcpy(counter->name, buf, length + 1);
+		counter->residency = NAN;
+
+		ext = array_add(full->exts);
+		if (!ext) {
+			full->parent.counters->count--;
+			free(counter->name);
+			return false;
+		}
+		ext->msr_addr = msrs[i].msr_addr;
+		ext->tsc = full->tscs->count - 1;
+		ext->started = false;
+		ext->last = 0;
+	}
+	return true;
+}
+
+struct cstate_t * cstate_init(struct topology_t * topology,
+	struct filter_t * filter) {
+	struct cstate_full_t * full;
+	bool discovered = false;
+	char prefix[40];
+	int i;
+
+	full = malloc(sizeof(struct cstate_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.counters = array_new(sizeof(struct cstate_counter_t),
+		cstate_counter_free);
+	full->exts = array_new(sizeof(struct cstate_counter_ext_t), NULL);
+	full->tscs = array_new(sizeof(struct cstate_tsc_t), NULL);
+	if (!full->parent.counters || !full->exts || !full->tscs) {
+		cstate_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+
+	for (i = 0; topology && i < topology->cpus->count; i++) {
+		struct topology_cpu_t * cpu = array_get(topology->cpus, i);
+		bool success = true;
+		int fd;
+
+		if (!cpu->first_in_core) {
+			continue;
+		}
+		fd = topology_msr(cpu);
+		if (fd < 0) {
+			continue;
+		}
+		if (cpu->first_in_package) {
+			sprintf(prefix, "Package %d", cpu->package);
+			success = cstate_add_cpu(full, filter, fd, prefix,
+				cstate_package_msrs, ARRAY_SIZE(cstate_package_msrs),
+				&discovered);
+		}
+		if (success) {
+			topology_core_name(topology, cpu, prefix);
+			success = cstate_add_cpu(full, filter, fd, prefix,
+				cstate_core_msrs, ARRAY_SIZE(cstate_core_msrs), &discovered);
+		}
+		if (!success) {
+			cstate_free(&full->parent);
+			fprintf(stderr, "No enough memory\n");
+			return NULL;
+		}
+	}
+
+	if (full->parent.counters->count == 0) {
+		cstate_free(&full->parent);
+		if (!discovered) {
+			fprintf(stderr, "Failed to read C-state residency MSR\n");
+		}
+		return NULL;
+	}
+	array_shrink(full->parent.counters);
+	array_shrink(full->exts);
+	array_shrink(full->tscs);
+	return &full->parent;
+}
+
+void cstate_measure(struct cstate_t * cstate) {
+	if (cstate) {
+		struct cstate_full_t * full = (struct cstate_full_t *) cstate;
+		int i;
+
+		for (i = 0; i < full->tscs->count; i++) {
+			struct cstate_tsc_t * tsc = array_get(full->tscs, i);
+			uint64_t value;
+			if (msr_rd(tsc->fd_msr, MSR_ADDR_TSC, value)) {
+				tsc->delta = tsc->valid ? value - tsc->value : 0;
+				tsc->value = value;
+				tsc->valid = true;
+			} else {
+				tsc->delta = 0;
+				tsc->valid = false;
+			}
+		}
+
+		for (i = 0; i < full->parent.counters->count; i++) {
+			struct cstate_counter_t * counter = array_get(full->parent.counters, i);
+			struct cstate_counter_ext_t * ext = array_get(full->exts, i);
+			struct cstate_tsc_t * tsc = array_get(full->tscs, ext->tsc);
+			uint64_t value;
+
+			if (msr_rd(tsc->fd_msr, ext->msr_addr, value)) {
+				/* residency counters tick at TSC rate */
+				counter->residency = ext->started && tsc->delta > 0
+					? (double) (value - ext->last) / tsc->delta : NAN;
+				if (counter->residency > 1) {
+					counter->residency = 1;
+				}
+				ext->started = true;
+				ext->last = value;
+			} else {
+				counter->residency = NAN;
+				ext->started = false;
+			}
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef __CSTATE_H__
+#define __CSTATE_H__
+
+#include "filter.h"
+#include "topology.h"
+#include "util.h"
+
+struct cstate_counter_t {
+	char * name;
+	float residency;
+};
+
+/* Residency is a fraction of TSC ticks between measurements. */
+struct cstate_t {
+	struct array_t * counters;
+};
+
+struct cstate_t * cstate_init(struct topology_t * topology,
+	struct filter_t * filter);
+void cstate_measure(struct cstate_t * cstate);
+void cstate_free(struct cstate_t * cstate);
+
+#endif
@@ -0,0 +1,150 @@
+#include "filter.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pattern is a glob, optionally ending with a numeric range like "Core 0-3"
+ * which matches names ending with a number within the range. */
+struct filter_pattern_t {
+	char * glob;
+	bool range;
+	long from;
+	long to;
+};
+
+struct filter_t {
+	struct array_t * patterns;
+};
+
+static void filter_pattern_free(void * pointer) {
+	struct filter_pattern_t * pattern = pointer;
+	free(pattern->glob);
+}
+
+static bool parse_range(struct filter_pattern_t * pattern, char * glob) {
+	int length = strlen(glob);
+	char * dash;
+	char * tmp;
+	int i = length;
+
+	while (i > 0 && isdigit((unsigned char) glob[i - 1])) {
+		i--;
+	}
+	if (i == length || i == 0 || glob[i - 1] != '-') {
+		return false;
+	}
+	dash = &glob[i - 1];
+	while (i > 1 && isdigit((unsigned char) glob[i - 2])) {
+		i--;
+	}
+	if (&glob[i - 1] == dash) {
+		return false;
+	}
+	pattern->from = strtol(&glob[i - 1], &tmp, 10);
+	pattern->to = strtol(&dash[1], NULL, 10);
+	if (tmp != dash || pattern->from > pattern->to) {
+		return false;
+	}
+	glob[i - 1] = '\0';
+	pattern->range = true;
+	return true;
+}
+
+struct filter_t * filter_init(const char * patterns) {
+	struct filter_t * filter = malloc(sizeof(struct filter_t));
+	const char * line = patterns;
+
+	if (filter) {
+		filter->patterns = array_new(sizeof(struct filter_pattern_t),
+			filter_pattern_free);
+	}
+	if (!filter || !filter->patterns) {
+		free(filter);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+
+	while (line) {
+		const char * tmp = strchr(line, ',');
+		int len = tmp ? (int) (tmp - line) : (int) strlen(line);
+		struct filter_pattern_t * pattern;
+
+		if (len > 0) {
+			pattern = array_add(filter->patterns);
+			if (pattern) {
+				pattern->glob = malloc(len + 1);
+				if (!pattern->glob) {
+					filter->patterns->count--;
+					pattern = NULL;
+				}
+			}
+			if (!pattern) {
+				filter_free(filter);
+				fprintf(stderr, "No enough memory\n");
+				return NULL;
+			}
+			memcpy(pattern->glob, line, len);
+			pattern->glob[len] = '\0';
+			pattern->range = false;
+			parse_range(pattern, pattern->glob);
+		}
+		line = tmp ? &tmp[1] : NULL;
+	}
+
+	if (filter->patterns->count == 0) {
+		filter_free(filter);
+		fprintf(stderr, "No sensor patterns specified\n");
+		return NULL;
+	}
+	array_shrink(filter->patterns);
+	return filter;
+}
+
+static bool filter_pattern_match(struct filter_pattern_t * pattern,
+	const char * name) {
+	if (pattern->range) {
+		int length = strlen(name);
+		int i = length;
+		char prefix[length + 1];
+		long value;
+
+		while (i > 0 && isdigit((unsigned char) name[i - 1])) {
+			i--;
+		}
+		if (i == length) {
+			return false;
+		}
+		value = strtol(&name[i], NULL, 10);
+		memcpy(prefix, name, i);
+		prefix[i] = '\0';
+		return value >= pattern->from && value <= pattern->to &&
+			!fnmatch(pattern->glob, prefix, 0);
+	} else {
+		return !fnmatch(pattern->glob, name, 0);
+	}
+}
+
+bool filter_match(struct filter_t * filter, const char * name) {
+	int i;
+
+	if (!filter) {
+		return true;
+	}
+	for (i = 0; i < filter->patterns->count; i++) {
+		if (filter_pattern_match(array_get(filter->patterns, i), name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void filter_free(struct filter_t * filter) {
+	if (filter) {
+		array_free(filter->patterns);
+		free(filter);
+	}
+}
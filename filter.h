@@ -0,0 +1,12 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <stdbool.h>
+
+struct filter_t;
+
+struct filter_t * filter_init(const char * patterns);
+bool filter_match(struct filter_t * filter, const char * name);
+void filter_free(struct filter_t * filter);
+
+#endif
@@ -0,0 +1,100 @@
+#include "frame.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char * frame_flag_names[FRAME_FLAG_COUNT] = {
+	[FRAME_FLAG_PROCHOT] = "PROCHOT",
+	[FRAME_FLAG_THERMAL] = "Thermal",
+	[FRAME_FLAG_CRITICAL] = "Critical",
+	[FRAME_FLAG_THRESHOLD] = "Threshold",
+	[FRAME_FLAG_POWER_LIMIT] = "Power limit",
+	[FRAME_FLAG_RSR] = "RSR",
+	[FRAME_FLAG_RATL] = "RATL",
+	[FRAME_FLAG_VR_THERMAL] = "VR thermal",
+	[FRAME_FLAG_VR_TDC] = "VR TDC",
+	[FRAME_FLAG_EDP] = "EDP",
+	[FRAME_FLAG_PL1] = "PL1",
+	[FRAME_FLAG_PL2] = "PL2",
+	[FRAME_FLAG_MAX_TURBO] = "Max turbo",
+	[FRAME_FLAG_TURBO_ATTENUATION] = "Turbo attenuation",
+	[FRAME_FLAG_GRAPHICS_DRIVER] = "Graphics driver",
+	[FRAME_FLAG_AUTONOMOUS] = "Autonomous",
+	[FRAME_FLAG_CORE_POWER] = "Core power"
+};
+
+const char * frame_flag_name(int flag) {
+	return flag >= 0 && flag < FRAME_FLAG_COUNT ? frame_flag_names[flag] : NULL;
+}
+
+static void frame_column_free(void * pointer) {
+	struct frame_column_t * column = pointer;
+	free(column->name);
+}
+
+struct frame_t * frame_init() {
+	struct frame_t * frame = malloc(sizeof(struct frame_t));
+	if (!frame) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	frame->columns = array_new(sizeof(struct frame_column_t),
+		frame_column_free);
+	if (!frame->columns) {
+		free(frame);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	frame->values = NULL;
+	frame->epoch = 0;
+	frame->time = 0;
+	frame->skew = 0;
+	return frame;
+}
+
+int frame_add_column(struct frame_t * frame, const char * name,
+	enum frame_unit unit) {
+	struct frame_column_t * column;
+	int length = strlen(name);
+	char * copy = malloc(length + 1);
+	if (!copy) {
+		return -1;
+	}
+	memcpy(copy, name, length + 1);
+	column = array_add(frame->columns);
+	if (!column) {
+		free(copy);
+		return -1;
+	}
+	column->name = copy;
+	column->unit = unit;
+	return frame->columns->count - 1;
+}
+
+bool frame_alloc(struct frame_t * frame) {
+	int count = frame->columns->count;
+	int i;
+	array_shrink(frame->columns);
+	frame->values = malloc((count > 0 ? count : 1) * sizeof(float));
+	if (!frame->values) {
+		fprintf(stderr, "No enough memory\n");
+		return false;
+	}
+	for (i = 0; i < count; i++) {
+		frame->values[i] = NAN;
+	}
+	return true;
+}
+
+void frame_free(struct frame_t * frame) {
+	if (frame) {
+		array_free(frame->columns);
+		if (frame->values) {
+			free(frame->values);
+		}
+		free(frame);
+	}
+}
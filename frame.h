@@ -0,0 +1,62 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+
+#include "util.h"
+
+enum frame_unit {
+	FRAME_UNIT_POWER,
+	FRAME_UNIT_TEMPERATURE,
+	FRAME_UNIT_FREQUENCY,
+	FRAME_UNIT_ENERGY,
+	FRAME_UNIT_PERCENT,
+	FRAME_UNIT_FLAGS,
+	FRAME_UNIT_VOLTAGE
+};
+
+/* Bits of FRAME_UNIT_FLAGS values, stored in records, so new flags
+ * should be appended to the end. */
+enum frame_flag {
+	FRAME_FLAG_PROCHOT,
+	FRAME_FLAG_THERMAL,
+	FRAME_FLAG_CRITICAL,
+	FRAME_FLAG_THRESHOLD,
+	FRAME_FLAG_POWER_LIMIT,
+	FRAME_FLAG_RSR,
+	FRAME_FLAG_RATL,
+	FRAME_FLAG_VR_THERMAL,
+	FRAME_FLAG_VR_TDC,
+	FRAME_FLAG_EDP,
+	FRAME_FLAG_PL1,
+	FRAME_FLAG_PL2,
+	FRAME_FLAG_MAX_TURBO,
+	FRAME_FLAG_TURBO_ATTENUATION,
+	FRAME_FLAG_GRAPHICS_DRIVER,
+	FRAME_FLAG_AUTONOMOUS,
+	FRAME_FLAG_CORE_POWER,
+	FRAME_FLAG_COUNT
+};
+
+struct frame_column_t {
+	char * name;
+	enum frame_unit unit;
+};
+
+/* Columns of the same unit are kept contiguous, so values form one flat
+ * array of per-unit slices. Missing readings are stored as NAN.
+ * Time is relative to epoch which is a wall clock time in seconds. */
+struct frame_t {
+	struct array_t * columns;
+	float * values;
+	double epoch;
+	double time;
+	double skew;
+};
+
+struct frame_t * frame_init();
+int frame_add_column(struct frame_t * frame, const char * name,
+	enum frame_unit unit);
+bool frame_alloc(struct frame_t * frame);
+const char * frame_flag_name(int flag);
+void frame_free(struct frame_t * frame);
+
+#endif
@@ -1,3 +1,4 @@
+#include "bench.h"
 #include "measure.h"
 #include "modes.h"
 #include "util.h"
@@ -170,6 +171,73 @@ static bool arg_check_measure_sleep(struct arg_t * arg) {
 	return true;
 }
 
+static bool arg_check_measure_count(struct arg_t * arg) {
+	if (arg->float_value < 0 || arg->float_value != (int) arg->float_value) {
+		fprintf(stderr, "Count should be a non-negative integer.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_measure_duration(struct arg_t * arg) {
+	if (arg->float_value < 0) {
+		fprintf(stderr, "Duration should not be negative.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_measure_rapl(struct arg_t * arg) {
+	if (strcmp(arg->value, "auto") && strcmp(arg->value, "sysfs") &&
+		strcmp(arg->value, "msr")) {
+		fprintf(stderr, "Available RAPL sources: auto, sysfs, msr.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_measure_temperature(struct arg_t * arg) {
+	if (strcmp(arg->value, "auto") && strcmp(arg->value, "hwmon") &&
+		strcmp(arg->value, "msr")) {
+		fprintf(stderr, "Available temperature sources: auto, hwmon, msr.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_measure_frequency(struct arg_t * arg) {
+	if (strcmp(arg->value, "auto") && strcmp(arg->value, "sysfs") &&
+		strcmp(arg->value, "aperf")) {
+		fprintf(stderr, "Available frequency sources: auto, sysfs, aperf.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_bench_iterations(struct arg_t * arg) {
+	if (arg->float_value < 1 || arg->float_value != (int) arg->float_value) {
+		fprintf(stderr, "Iterations should be a positive integer.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_bench_cpus(struct arg_t * arg) {
+	if (arg->float_value < 0 || arg->float_value != (int) arg->float_value) {
+		fprintf(stderr, "CPU count should be a non-negative integer.\n");
+		return false;
+	}
+	return true;
+}
+
+static bool arg_check_replay_speed(struct arg_t * arg) {
+	if (arg->float_value < 0) {
+		fprintf(stderr, "Speed should not be negative.\n");
+		return false;
+	}
+	return true;
+}
+
 int main(int argc, char ** argv) {
 	if (argc >= 2 && !strcmp(argv[1], "read")) {
 		return parse_args(argc - 2, &argv[2], NULL) &&
@@ -182,14 +250,94 @@ int main(int argc, char ** argv) {
 		return parse_args(argc - 2, &argv[2], args) &&
 			read_apply_mode(true, arg(args, "trigger")->present) ? 0 : 1;
 	} else if (argc >= 2 && !strcmp(argv[1], "measure")) {
-		struct arg_t args[3] = {
+		struct arg_t args[14] = {
 			ARG_STRING('f', "format", arg_check_measure_format, "terminal"),
 			ARG_FLOAT('s', "sleep", arg_check_measure_sleep, 1),
+			ARG_FLOAT('c', "count", arg_check_measure_count, 0),
+			ARG_FLOAT('d', "duration", arg_check_measure_duration, 0),
+			ARG_STRING('r', "record", NULL, NULL),
+			ARG_STRING('\0', "rapl", arg_check_measure_rapl, "auto"),
+			ARG_STRING('\0', "temperature", arg_check_measure_temperature,
+				"auto"),
+			ARG_STRING('\0', "frequency", arg_check_measure_frequency,
+				"auto"),
+			ARG_EMPTY('\0', "cstates", NULL),
+			ARG_EMPTY('\0', "throttle", NULL),
+			ARG_EMPTY('\0', "voltage", NULL),
+			ARG_STRING('\0', "sensors", NULL, NULL),
+			ARG_STRING('\0', "root", NULL, NULL),
 			ARG_END
 		};
-		return parse_args(argc - 2, &argv[2], args) &&
-			measure_mode(!strcmp("csv", arg(args, "format")->value),
-				arg(args, "sleep")->float_value) ? 0 : 1;
+		struct measure_options_t options;
+		int i;
+		options.command = NULL;
+		for (i = 2; i < argc; i++) {
+			if (!strcmp(argv[i], "--")) {
+				if (i + 1 >= argc) {
+					fprintf(stderr, "No command specified.\n");
+					return 1;
+				}
+				options.command = &argv[i + 1];
+				break;
+			}
+		}
+		if (!parse_args(i - 2, &argv[2], args)) {
+			return 1;
+		}
+		options.record = arg(args, "record")->value;
+		options.render = !options.record || arg(args, "format")->present;
+		options.format = !strcmp("csv", arg(args, "format")->value)
+			? RENDER_FORMAT_CSV : RENDER_FORMAT_TERMINAL;
+		options.sleep = arg(args, "sleep")->float_value;
+		options.count = (int) arg(args, "count")->float_value;
+		options.duration = arg(args, "duration")->float_value;
+		options.rapl_source = !strcmp("sysfs", arg(args, "rapl")->value)
+			? RAPL_SOURCE_SYSFS : !strcmp("msr", arg(args, "rapl")->value)
+			? RAPL_SOURCE_MSR : RAPL_SOURCE_AUTO;
+		options.temperature_source =
+			!strcmp("hwmon", arg(args, "temperature")->value)
+			? TEMPERATURE_SOURCE_HWMON
+			: !strcmp("msr", arg(args, "temperature")->value)
+			? TEMPERATURE_SOURCE_MSR : TEMPERATURE_SOURCE_AUTO;
+		options.frequency_source =
+			!strcmp("sysfs", arg(args, "frequency")->value)
+			? FREQUENCY_SOURCE_SYSFS
+			: !strcmp("aperf", arg(args, "frequency")->value)
+			? FREQUENCY_SOURCE_APERF : FREQUENCY_SOURCE_AUTO;
+		options.cstates = arg(args, "cstates")->present;
+		options.throttle = arg(args, "throttle")->present;
+		options.voltage = arg(args, "voltage")->present;
+		options.sensors = arg(args, "sensors")->value;
+		set_root(arg(args, "root")->value);
+		return measure_mode(&options) ? 0 : 1;
+	} else if (argc >= 2 && !strcmp(argv[1], "bench")) {
+		struct arg_t args[4] = {
+			ARG_FLOAT('n', "iterations", arg_check_bench_iterations, 1000),
+			ARG_FLOAT('\0', "cpus", arg_check_bench_cpus, 0),
+			ARG_STRING('\0', "root", NULL, NULL),
+			ARG_END
+		};
+		struct bench_options_t options;
+		if (!parse_args(argc - 2, &argv[2], args)) {
+			return 1;
+		}
+		options.iterations = (int) arg(args, "iterations")->float_value;
+		options.cpus = (int) arg(args, "cpus")->float_value;
+		set_root(arg(args, "root")->value);
+		return bench_mode(&options) ? 0 : 1;
+	} else if (argc >= 3 && !strcmp(argv[1], "replay")) {
+		struct arg_t args[3] = {
+			ARG_STRING('f', "format", arg_check_measure_format, "terminal"),
+			ARG_FLOAT('x', "speed", arg_check_replay_speed, 1),
+			ARG_END
+		};
+		return parse_args(argc - 3, &argv[3], args) &&
+			replay_mode(argv[2], !strcmp("csv", arg(args, "format")->value)
+				? RENDER_FORMAT_CSV : RENDER_FORMAT_TERMINAL,
+				arg(args, "speed")->float_value) ? 0 : 1;
+	} else if (argc >= 3 && !strcmp(argv[1], "convert")) {
+		return parse_args(argc - 3, &argv[3], NULL) &&
+			convert_mode(argv[2]) ? 0 : 1;
 	} else if (argc >= 2 && !strcmp(argv[1], "daemon")) {
 		return parse_args(argc - 2, &argv[2], NULL) &&
 			daemon_mode() ? 0 : 1;
@@ -198,9 +346,28 @@ int main(int argc, char ** argv) {
 			"Usage: intel-undervolt MODE [OPTION]...\n"
 			"  read                     read and display current values\n"
 			"  apply                    apply values from config file\n"
-			"  measure                  measure power consumption\n"
+			"  measure [-- <command>]   measure power consumption\n"
 			"    -f, --format <format>  output format (terminal, csv)\n"
 			"    -s, --sleep <interval> sleep interval in seconds\n"
+			"    -c, --count <count>    stop after the given number of samples\n"
+			"    -d, --duration <time>  stop after the given number of seconds\n"
+			"    -r, --record <file>    append binary records to file\n"
+			"    --rapl <source>        RAPL source (auto, sysfs, msr)\n"
+			"    --temperature <source> temperature source (auto, hwmon, msr)\n"
+			"    --frequency <source>   frequency source (auto, sysfs, aperf)\n"
+			"    --cstates              show C-state residency\n"
+			"    --throttle             show throttle reasons\n"
+			"    --voltage              show core voltage\n"
+			"    --sensors <list>       show only the listed sensors\n"
+			"    --root <dir>           read MSR devices, sysfs and procfs from dir\n"
+			"  bench                    measure the cost of every sensor source\n"
+			"    -n, --iterations <n>   number of timed readings of every source\n"
+			"    --cpus <count>         read scaling_cur_freq of count CPUs\n"
+			"    --root <dir>           read MSR devices, sysfs and procfs from dir\n"
+			"  replay <file>            replay binary records\n"
+			"    -f, --format <format>  output format (terminal, csv)\n"
+			"    -x, --speed <factor>   replay speed, 0 for no delay\n"
+			"  convert <file>           convert binary records to csv\n"
 			"  daemon                   run in daemon mode\n");
 		return argc == 1 ? 0 : 1;
 	} else {
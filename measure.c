@@ -1,240 +1,150 @@
+#include "aperf.h"
+#include "cstate.h"
+#include "filter.h"
+#include "frame.h"
 #include "measure.h"
 #include "power.h"
+#include "record.h"
+#include "sensor.h"
+#include "therm.h"
+#include "throttle.h"
+#include "topology.h"
 #include "util.h"
+#include "vid.h"
 
-#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <iconv.h>
-#include <langinfo.h>
-#include <locale.h>
+#include <limits.h>
+#include <math.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
-#define DIR_HWMON "/sys/class/hwmon"
 #define BUFSZ 80
+/* a jump longer than this many sampling intervals is a gap between runs */
+#define REPLAY_MAX_GAP 10
+
+struct aperf_columns_t {
+	int frequency;
+	int busy;
+};
 
 struct hwmon_t {
 	char * name;
-	char * dir;
-	int index;
+	int sensor;
 };
 
 static void hwmon_free(void * pointer) {
 	struct hwmon_t * hwmon = pointer;
 	free(hwmon->name);
-	free(hwmon->dir);
-}
-
-static void write_maxname(const char * name, int maxname) {
-	int len = strlen(name);
-	int i;
-	printf("%s:", name);
-	for (i = len - 1; i < maxname; i++) {
-		printf(" ");
-	}
-}
-
-static void print_rapl(struct rapl_t * rapl, int maxname, bool * nl, bool csv) {
-	bool nll = false;
-	int i;
-
-	rapl_measure(rapl);
-	if (rapl) {
-		for (i = 0; i < rapl->devices->count; i++) {
-			struct rapl_device_t * device = array_get(rapl->devices, i);
-			if (csv) {
-				CSV_SEPARATOR(nl, nll);
-				printf("%.03f", device->power);
-			} else {
-				NEW_LINE(nl, nll);
-				write_maxname(device->name, maxname);
-				printf("%9.03f W\n", device->power);
-			}
-		}
-	}
-}
-
-static void print_hwmon(struct array_t * hwmons, int maxname, char * buf,
-	char * degstr, bool * nl, bool csv) {
-	bool nll = false;
-	int i;
-
-	for (i = 0; hwmons && i < hwmons->count; i++) {
-		struct hwmon_t * hwmon = array_get(hwmons, i);
-		int fd;
-
-		sprintf(buf, DIR_HWMON "/%s/temp%d_input", hwmon->dir, hwmon->index);
-		fd = open(buf, O_RDONLY);
-		if (fd >= 0) {
-			int size = read(fd, buf, BUFSZ - 1);
-			if (size > 0) {
-				double value;
-				buf[buf[size - 1] == '\n' ? size - 1 : size] = '\0';
-				value = atol(buf) / 1000.;
-				if (csv) {
-					CSV_SEPARATOR(nl, nll);
-					printf("%.03f", value);
-				} else {
-					NEW_LINE(nl, nll);
-					write_maxname(hwmon->name, maxname);
-					printf("%9.03f%s\n", value, degstr);
-				}
-			}
-			close(fd);
-		}
-	}
 }
 
-static void print_cpufreq(int maxname, char * buf, bool * nl, bool csv) {
-	bool nll = false;
-
-	int i;
-	for (i = 0;; i++) {
-		sprintf(buf, "/sys/bus/cpu/devices/cpu%d/cpufreq/scaling_cur_freq", i);
-		int fd = open(buf, O_RDONLY);
-		if (fd < 0) {
-			break;
-		}
-		int size = read(fd, buf, BUFSZ - 1);
-		if (size > 0) {
-			buf[buf[size - 1] == '\n' ? size - 1 : size] = '\0';
-			double dval = atol(buf) / 1000.;
-			if (csv) {
-				CSV_SEPARATOR(nl, nll);
-				printf("%.03f", dval);
-			} else {
-				sprintf(buf, "Core %d", i);
-				NEW_LINE(nl, nll);
-				write_maxname(buf, maxname);
-				printf("%9.03f MHz\n", dval);
-			}
-		}
-		close(fd);
-	}
-}
-
-static bool get_hwmon(const char * name, char * out) {
-	char buf[BUFSZ];
-
-	DIR * dir = opendir(DIR_HWMON);
-	if (dir == NULL) {
-		fprintf(stderr, "Failed to open hwmon directory\n");
-		return NULL;
-	}
-	struct dirent * dirent;
-	while ((dirent = readdir(dir))) {
-		if (strlen(dirent->d_name) <= 30) {
-BEGIN_IGNORE_FORMAT_OVERFLOW
-			sprintf(buf, DIR_HWMON "/%s/name", dirent->d_name);
-END_IGNORE_FORMAT_OVERFLOW
-			int fd = open(buf, O_RDONLY);
-			if (fd >= 0) {
-				int size = read(fd, buf, BUFSZ - 1);
-				if (size > 1) {
-					int nlen = buf[size - 1] == '\n' ? size - 2 : size - 1;
-					buf[nlen + 1] = '\0';
-					if (!strcmp(buf, name)) {
-						strcpy(out, dirent->d_name);
-						close(fd);
-						closedir(dir);
-						return true;
-					}
-				}
-				close(fd);
-			}
-		}
-	}
-	closedir(dir);
-
-	return false;
-}
-
-static struct array_t * get_coretemp(int * maxname) {
-	char hdir[BUFSZ];
+static bool get_coretemp_hwmon(struct sensors_t * sensors, const char * hdir,
+	struct filter_t * filter, bool multi_package, struct array_t ** hwmons) {
+	char path[PATH_MAX];
 	char buf[BUFSZ];
-	struct array_t * hwmons = NULL;
+	int package = -1;
 	int i;
 
-	if (!get_hwmon("coretemp", hdir)) {
-		fprintf(stderr, "Failed to find coretemp hwmon\n");
-		return NULL;
-	}
-
 	for (i = 1;; i++) {
 		int fd;
+		int sensor;
 		char * name = NULL;
-		char * dir;
 		struct hwmon_t * hwmon;
 
-BEGIN_IGNORE_FORMAT_OVERFLOW
-		sprintf(buf, DIR_HWMON "/%s/temp%d_input", hdir, i);
-END_IGNORE_FORMAT_OVERFLOW
-		fd = open(buf, O_RDONLY);
-		if (fd < 0) {
+		snprintf(path, sizeof(path), "%s" DIR_HWMON "/%s/temp%d_input",
+			get_root(), hdir, i);
+		if (access(path, F_OK) != 0) {
 			break;
 		}
-		close(fd);
 
-BEGIN_IGNORE_FORMAT_OVERFLOW
-		sprintf(buf, DIR_HWMON "/%s/temp%d_label", hdir, i);
-END_IGNORE_FORMAT_OVERFLOW
-		fd = open(buf, O_RDONLY);
+		snprintf(path, sizeof(path), "%s" DIR_HWMON "/%s/temp%d_label",
+			get_root(), hdir, i);
+		fd = open(path, O_RDONLY);
 		if (fd >= 0) {
 			int size = read(fd, buf, BUFSZ - 1);
+			close(fd);
 			if (size > 1) {
 				int nlen = buf[size - 1] == '\n' ? size - 2 : size - 1;
 				buf[nlen + 1] = '\0';
-				name = malloc(strlen(buf) + 1);
+				name = malloc(strlen(buf) + 20);
 				if (!name) {
-					break;
+					return false;
+				}
+				if (sscanf(buf, "Package id %d", &package) != 1 &&
+					multi_package && package >= 0) {
+					/* core labels repeat in every package */
+					sprintf(name, "Package %d %s", package, buf);
+				} else {
+					strcpy(name, buf);
 				}
-				strcpy(name, buf);
 			}
-			close(fd);
 		}
 		if (!name) {
 			sprintf(buf, "temp%d", i);
 			name = malloc(strlen(buf) + 1);
 			if (!name) {
-				break;
+				return false;
 			}
 			strcpy(name, buf);
 		}
 
-		dir = malloc(strlen(hdir) + 1);
-		if (!dir) {
+		if (!filter_match(filter, name)) {
 			free(name);
-			break;
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s" DIR_HWMON "/%s/temp%d_input",
+			get_root(), hdir, i);
+		sensor = sensors_add(sensors, path);
+		if (sensor < 0) {
+			free(name);
+			continue;
 		}
-		strcpy(dir, hdir);
 
-		if (!hwmons) {
-			hwmons = array_new(sizeof(struct hwmon_t), hwmon_free);
-			if (!hwmons) {
+		if (!*hwmons) {
+			*hwmons = array_new(sizeof(struct hwmon_t), hwmon_free);
+			if (!*hwmons) {
 				free(name);
-				free(dir);
-				break;
+				return false;
 			}
 		}
-		hwmon = array_add(hwmons);
+		hwmon = array_add(*hwmons);
 		if (!hwmon) {
 			free(name);
-			free(dir);
-			break;
+			return false;
 		}
 
 		hwmon->name = name;
-		hwmon->dir = dir;
-		hwmon->index = i;
-		if (maxname) {
-			int len = strlen(name);
-			*maxname = len > *maxname ? len : *maxname;
+		hwmon->sensor = sensor;
+	}
+	return true;
+}
+
+static struct array_t * get_coretemp(struct sensors_t * sensors,
+	struct filter_t * filter, bool verbose) {
+	char hdir[BUFSZ];
+	struct array_t * hwmons = NULL;
+	bool multi_package;
+	int i;
+
+	if (!sensors_find_hwmon("coretemp", hdir, 0)) {
+		if (verbose) {
+			fprintf(stderr, "Failed to find coretemp hwmon\n");
+		}
+		return NULL;
+	}
+	multi_package = sensors_find_hwmon("coretemp", hdir, 1);
+
+	for (i = 0; sensors_find_hwmon("coretemp", hdir, i); i++) {
+		if (!get_coretemp_hwmon(sensors, hdir, filter, multi_package,
+			&hwmons)) {
+			break;
 		}
 	}
 
@@ -244,103 +154,614 @@ END_IGNORE_FORMAT_OVERFLOW
 	return hwmons;
 }
 
+struct cpufreq_t {
+	int cpu;
+	int sensor;
+};
+
+static struct array_t * get_cpufreq(struct sensors_t * sensors,
+	struct filter_t * filter) {
+	char path[PATH_MAX];
+	char buf[BUFSZ];
+	struct array_t * cpufreqs = NULL;
+	int i;
+
+	for (i = 0;; i++) {
+		int sensor;
+		struct cpufreq_t * item;
+
+		snprintf(path, sizeof(path), "%s" DIR_CPU_DEVICES
+			"/cpu%d/cpufreq/scaling_cur_freq", get_root(), i);
+		if (access(path, F_OK) != 0) {
+			break;
+		}
+		sprintf(buf, "CPU %d", i);
+		if (!filter_match(filter, buf)) {
+			continue;
+		}
+		sensor = sensors_add(sensors, path);
+		if (sensor < 0) {
+			continue;
+		}
+
+		if (!cpufreqs) {
+			cpufreqs = array_new(sizeof(struct cpufreq_t), NULL);
+			if (!cpufreqs) {
+				break;
+			}
+		}
+		item = array_add(cpufreqs);
+		if (!item) {
+			break;
+		}
+		item->cpu = i;
+		item->sensor = sensor;
+	}
+
+	if (cpufreqs) {
+		array_shrink(cpufreqs);
+	}
+	return cpufreqs;
+}
+
+struct sampler_t {
+	struct rapl_t * rapl;
+	struct sensors_t * sensors;
+	struct topology_t * topology;
+	struct therm_t * therm;
+	struct aperf_t * aperf;
+	struct cstate_t * cstate;
+	struct throttle_t * throttle;
+	struct vid_t * vid;
+	struct array_t * coretemp;
+	struct array_t * cpufreq;
+	struct array_t * aperf_columns;
+	struct filter_t * filter;
+	struct frame_t * frame;
+	int rapl_column;
+	int energy_column;
+	int coretemp_column;
+	int cpufreq_column;
+	int cstate_column;
+	int throttle_column;
+	int vid_column;
+	struct timespec start;
+};
+
+static void sampler_free(struct sampler_t * sampler) {
+	if (sampler->rapl) {
+		rapl_free(sampler->rapl);
+	}
+	if (sampler->coretemp) {
+		array_free(sampler->coretemp);
+	}
+	therm_free(sampler->therm);
+	aperf_free(sampler->aperf);
+	cstate_free(sampler->cstate);
+	throttle_free(sampler->throttle);
+	vid_free(sampler->vid);
+	topology_free(sampler->topology);
+	if (sampler->cpufreq) {
+		array_free(sampler->cpufreq);
+	}
+	if (sampler->aperf_columns) {
+		array_free(sampler->aperf_columns);
+	}
+	sensors_free(sampler->sensors);
+	filter_free(sampler->filter);
+	frame_free(sampler->frame);
+}
+
+static bool sampler_init(struct sampler_t * sampler,
+	struct measure_options_t * options) {
+	char buf[BUFSZ];
+	bool nomem = false;
+	int i;
+
+	memset(sampler, 0, sizeof(struct sampler_t));
+	if (options->sensors) {
+		sampler->filter = filter_init(options->sensors);
+		if (!sampler->filter) {
+			return false;
+		}
+	}
+	sampler->rapl = rapl_init(options->rapl_source, sampler->filter);
+	sampler->sensors = sensors_init();
+	sampler->frame = frame_init();
+	if (!sampler->sensors || !sampler->frame) {
+		sampler_free(sampler);
+		return false;
+	}
+	if (options->temperature_source != TEMPERATURE_SOURCE_MSR) {
+		sampler->coretemp = get_coretemp(sampler->sensors, sampler->filter,
+			options->temperature_source == TEMPERATURE_SOURCE_HWMON);
+	}
+	if ((!sampler->coretemp &&
+		options->temperature_source != TEMPERATURE_SOURCE_HWMON) ||
+		options->frequency_source != FREQUENCY_SOURCE_SYSFS ||
+		options->cstates || options->throttle || options->voltage) {
+		sampler->topology = topology_init();
+	}
+	if (!sampler->coretemp &&
+		options->temperature_source != TEMPERATURE_SOURCE_HWMON) {
+		sampler->therm = therm_init(sampler->topology, sampler->filter);
+	}
+	if (options->frequency_source != FREQUENCY_SOURCE_SYSFS) {
+		sampler->aperf = aperf_init(sampler->topology, sampler->filter,
+			options->frequency_source == FREQUENCY_SOURCE_APERF);
+	}
+	if (!sampler->aperf &&
+		options->frequency_source != FREQUENCY_SOURCE_APERF) {
+		sampler->cpufreq = get_cpufreq(sampler->sensors, sampler->filter);
+	}
+	if (options->cstates) {
+		sampler->cstate = cstate_init(sampler->topology, sampler->filter);
+	}
+	if (options->throttle) {
+		sampler->throttle = throttle_init(sampler->topology, sampler->filter);
+	}
+	if (options->voltage) {
+		sampler->vid = vid_init(sampler->topology, sampler->filter);
+	}
+
+	sampler->rapl_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->rapl &&
+		i < sampler->rapl->devices->count; i++) {
+		struct rapl_device_t * device = array_get(sampler->rapl->devices, i);
+		nomem = frame_add_column(sampler->frame, device->name,
+			FRAME_UNIT_POWER) < 0;
+	}
+	sampler->energy_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->rapl &&
+		i < sampler->rapl->devices->count; i++) {
+		struct rapl_device_t * device = array_get(sampler->rapl->devices, i);
+		snprintf(buf, sizeof(buf), "%s energy", device->name);
+		nomem = frame_add_column(sampler->frame, buf, FRAME_UNIT_ENERGY) < 0;
+	}
+	sampler->coretemp_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->coretemp &&
+		i < sampler->coretemp->count; i++) {
+		struct hwmon_t * hwmon = array_get(sampler->coretemp, i);
+		nomem = frame_add_column(sampler->frame, hwmon->name,
+			FRAME_UNIT_TEMPERATURE) < 0;
+	}
+	for (i = 0; !nomem && sampler->therm &&
+		i < sampler->therm->sensors->count; i++) {
+		struct therm_sensor_t * sensor = array_get(sampler->therm->sensors, i);
+		nomem = frame_add_column(sampler->frame, sensor->name,
+			FRAME_UNIT_TEMPERATURE) < 0;
+	}
+	sampler->cpufreq_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->cpufreq &&
+		i < sampler->cpufreq->count; i++) {
+		struct cpufreq_t * cpufreq = array_get(sampler->cpufreq, i);
+		sprintf(buf, "CPU %d", cpufreq->cpu);
+		nomem = frame_add_column(sampler->frame, buf,
+			FRAME_UNIT_FREQUENCY) < 0;
+	}
+	if (sampler->aperf) {
+		sampler->aperf_columns = array_new(sizeof(struct aperf_columns_t), NULL);
+		nomem = !sampler->aperf_columns;
+	}
+	/* frequency and busy ratio of a CPU are selected separately */
+	for (i = 0; !nomem && sampler->aperf &&
+		i < sampler->aperf->cpus->count; i++) {
+		struct aperf_cpu_t * cpu = array_get(sampler->aperf->cpus, i);
+		struct aperf_columns_t * columns = array_add(sampler->aperf_columns);
+		if (!columns) {
+			nomem = true;
+			break;
+		}
+		columns->frequency = -1;
+		columns->busy = -1;
+		sprintf(buf, "CPU %d", cpu->cpu);
+		if (filter_match(sampler->filter, buf)) {
+			columns->frequency = frame_add_column(sampler->frame, buf,
+				FRAME_UNIT_FREQUENCY);
+			nomem = columns->frequency < 0;
+		}
+	}
+	for (i = 0; !nomem && sampler->aperf &&
+		i < sampler->aperf->cpus->count; i++) {
+		struct aperf_cpu_t * cpu = array_get(sampler->aperf->cpus, i);
+		struct aperf_columns_t * columns = array_get(sampler->aperf_columns, i);
+		sprintf(buf, "CPU %d busy", cpu->cpu);
+		if (filter_match(sampler->filter, buf)) {
+			columns->busy = frame_add_column(sampler->frame, buf,
+				FRAME_UNIT_PERCENT);
+			nomem = columns->busy < 0;
+		}
+	}
+	sampler->cstate_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->cstate &&
+		i < sampler->cstate->counters->count; i++) {
+		struct cstate_counter_t * counter =
+			array_get(sampler->cstate->counters, i);
+		nomem = frame_add_column(sampler->frame, counter->name,
+			FRAME_UNIT_PERCENT) < 0;
+	}
+	sampler->throttle_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->throttle &&
+		i < sampler->throttle->domains->count; i++) {
+		struct throttle_domain_t * domain =
+			array_get(sampler->throttle->domains, i);
+		nomem = frame_add_column(sampler->frame, domain->name,
+			FRAME_UNIT_FLAGS) < 0;
+		if (!nomem) {
+			sprintf(buf, "%s log", domain->name);
+			nomem = frame_add_column(sampler->frame, buf,
+				FRAME_UNIT_FLAGS) < 0;
+		}
+	}
+	sampler->vid_column = sampler->frame->columns->count;
+	for (i = 0; !nomem && sampler->vid && i < sampler->vid->cores->count;
+		i++) {
+		struct vid_core_t * core = array_get(sampler->vid->cores, i);
+		nomem = frame_add_column(sampler->frame, core->name,
+			FRAME_UNIT_VOLTAGE) < 0;
+	}
+
+	if (nomem) {
+		fprintf(stderr, "No enough memory\n");
+	} else if (sampler->filter && sampler->frame->columns->count == 0) {
+		fprintf(stderr, "No sensors match the filter\n");
+		sampler_free(sampler);
+		return false;
+	}
+	if (nomem || !frame_alloc(sampler->frame)) {
+		sampler_free(sampler);
+		return false;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock_gettime(CLOCK_MONOTONIC, &sampler->start);
+	sampler->frame->epoch = now.tv_sec + now.tv_nsec / 1000000000.;
+	return true;
+}
+
+static double timespec_diff(struct timespec * from, struct timespec * to) {
+	return (to->tv_sec - from->tv_sec) +
+		(to->tv_nsec - from->tv_nsec) / 1000000000.;
+}
+
+static void sampler_sample(struct sampler_t * sampler) {
+	struct frame_t * frame = sampler->frame;
+	float * values;
+	struct timespec begin;
+	struct timespec end;
+	int64_t raw;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	rapl_measure(sampler->rapl);
+	therm_measure(sampler->therm);
+	aperf_measure(sampler->aperf);
+	cstate_measure(sampler->cstate);
+	throttle_measure(sampler->throttle);
+	vid_measure(sampler->vid);
+	sensors_read(sampler->sensors);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	values = &frame->values[sampler->rapl_column];
+	for (i = 0; sampler->rapl && i < sampler->rapl->devices->count; i++) {
+		struct rapl_device_t * device = array_get(sampler->rapl->devices, i);
+		values[i] = device->power;
+	}
+	values = &frame->values[sampler->energy_column];
+	for (i = 0; sampler->rapl && i < sampler->rapl->devices->count; i++) {
+		struct rapl_device_t * device = array_get(sampler->rapl->devices, i);
+		values[i] = device->energy / 1000000.;
+	}
+	values = &frame->values[sampler->coretemp_column];
+	for (i = 0; sampler->coretemp && i < sampler->coretemp->count; i++) {
+		struct hwmon_t * hwmon = array_get(sampler->coretemp, i);
+		values[i] = sensors_value(sampler->sensors, hwmon->sensor, &raw)
+			? raw / 1000.f : NAN;
+	}
+	for (i = 0; sampler->therm && i < sampler->therm->sensors->count; i++) {
+		struct therm_sensor_t * sensor = array_get(sampler->therm->sensors, i);
+		values[i] = sensor->temperature;
+	}
+	values = &frame->values[sampler->cpufreq_column];
+	for (i = 0; sampler->cpufreq && i < sampler->cpufreq->count; i++) {
+		struct cpufreq_t * cpufreq = array_get(sampler->cpufreq, i);
+		values[i] = sensors_value(sampler->sensors, cpufreq->sensor, &raw)
+			? raw / 1000.f : NAN;
+	}
+	for (i = 0; sampler->aperf && i < sampler->aperf->cpus->count; i++) {
+		struct aperf_cpu_t * cpu = array_get(sampler->aperf->cpus, i);
+		struct aperf_columns_t * columns = array_get(sampler->aperf_columns, i);
+		if (columns->frequency >= 0) {
+			frame->values[columns->frequency] = cpu->frequency;
+		}
+		if (columns->busy >= 0) {
+			frame->values[columns->busy] = cpu->busy * 100;
+		}
+	}
+	values = &frame->values[sampler->cstate_column];
+	for (i = 0; sampler->cstate && i < sampler->cstate->counters->count; i++) {
+		struct cstate_counter_t * counter =
+			array_get(sampler->cstate->counters, i);
+		values[i] = counter->residency * 100;
+	}
+	values = &frame->values[sampler->throttle_column];
+	for (i = 0; sampler->throttle && i < sampler->throttle->domains->count;
+		i++) {
+		struct throttle_domain_t * domain =
+			array_get(sampler->throttle->domains, i);
+		values[2 * i] = domain->active;
+		values[2 * i + 1] = domain->logged;
+	}
+	values = &frame->values[sampler->vid_column];
+	for (i = 0; sampler->vid && i < sampler->vid->cores->count; i++) {
+		struct vid_core_t * core = array_get(sampler->vid->cores, i);
+		values[i] = core->voltage;
+	}
+
+	frame->time = timespec_diff(&sampler->start, &begin);
+	frame->skew = timespec_diff(&begin, &end);
+}
+
 static bool interrupted;
+static bool child_exited;
 
 static void sigint_handler(UNUSED int sig) {
 	interrupted = true;
 }
 
-bool measure_mode(bool csv, float sleep) {
-	char buf[BUFSZ];
-	int maxname = 0;
-	struct rapl_t * rapl = rapl_init();
-	struct array_t * coretemp = get_coretemp(&maxname);
-	char degstr[5] = " C";
-	bool tty = isatty(1);
+static void sigchld_handler(UNUSED int sig) {
+	child_exited = true;
+}
+
+static pid_t spawn_command(char ** command) {
+	pid_t pid = fork();
+	if (pid == 0) {
+		execvp(command[0], command);
+		fprintf(stderr, "Failed to execute %s: %s\n", command[0],
+			strerror(errno));
+		_exit(127);
+	} else if (pid < 0) {
+		perror("Failed to fork");
+	}
+	return pid;
+}
+
+static bool wait_command(pid_t pid) {
+	int status;
+
+	if (!child_exited) {
+		/* the run was bounded by count or duration */
+		kill(pid, interrupted ? SIGINT : SIGTERM);
+	}
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			perror("Failed to wait for command");
+			return false;
+		}
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Command exited with status %d\n",
+			WEXITSTATUS(status));
+		return false;
+	} else if (WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM &&
+		WTERMSIG(status) != SIGINT) {
+		fprintf(stderr, "Command was killed by signal %d\n",
+			WTERMSIG(status));
+		return false;
+	}
+	return true;
+}
+
+static void report_energy(struct sampler_t * sampler) {
+	int i;
 
-	if (rapl) {
-		int i;
-		for (i = 0; i < rapl->devices->count; i++) {
-			struct rapl_device_t * device = array_get(rapl->devices, i);
-			int length = strlen(device->name);
-			maxname = length > maxname ? length : maxname;
+	if (sampler->rapl && sampler->rapl->devices->count > 0) {
+		fprintf(stderr, "Energy consumed in %.3f s:\n",
+			sampler->frame->time);
+		for (i = 0; i < sampler->rapl->devices->count; i++) {
+			struct rapl_device_t * device =
+				array_get(sampler->rapl->devices, i);
+			fprintf(stderr, "  %s: %.3f J\n", device->name,
+				device->energy / 1000000.);
 		}
 	}
+}
 
-	struct timespec sleep_spec;
-	sleep_spec.tv_sec = (time_t) sleep;
-	sleep_spec.tv_nsec = (suseconds_t) ((sleep - sleep_spec.tv_sec)
-		* 1000000000.);
+bool measure_mode(struct measure_options_t * options) {
+	struct sampler_t sampler;
+	struct render_t * render = NULL;
+	struct record_writer_t * writer = NULL;
+	struct stats_t * stats = NULL;
+	bool success = true;
 
-	setlocale(LC_CTYPE, "");
-	if (!csv) {
-		iconv_t ic = iconv_open(nl_langinfo(CODESET), "ISO-8859-1");
-		if (ic != (iconv_t) -1) {
-			char in[3] = "\260C";
-			char * inptr = in;
-			char * outptr = degstr;
-			size_t insize = 3;
-			size_t outsize = sizeof(degstr);
-			iconv(ic, &inptr, &insize, &outptr, &outsize);
-			iconv_close(ic);
+	if (!sampler_init(&sampler, options)) {
+		return false;
+	}
+	stats = stats_init(sampler.frame);
+	if (!stats) {
+		sampler_free(&sampler);
+		return false;
+	}
+	if (options->record) {
+		writer = record_writer_init(options->record, sampler.frame);
+		if (!writer) {
+			stats_free(stats);
+			sampler_free(&sampler);
+			return false;
 		}
 	}
+	if (options->render) {
+		render = render_init(options->format, sampler.frame, true);
+		if (!render) {
+			record_writer_free(writer);
+			stats_free(stats);
+			sampler_free(&sampler);
+			return false;
+		}
+	}
+
+	struct ticker_t ticker;
+	ticker_init(&ticker, (int64_t) (options->sleep * 1000000000. + 0.5));
+
+	/* the last sample is taken exactly at the end of the run */
+	struct timespec deadline;
+	int64_t deadline_ns = (int64_t) sampler.start.tv_sec * 1000000000 +
+		sampler.start.tv_nsec +
+		(int64_t) (options->duration * 1000000000. + 0.5);
+	deadline.tv_sec = deadline_ns / 1000000000;
+	deadline.tv_nsec = deadline_ns % 1000000000;
 
 	interrupted = false;
+	child_exited = false;
 	struct sigaction act;
 	memset(&act, 0, sizeof(struct sigaction));
 	act.sa_handler = sigint_handler;
 	sigaction(SIGINT, &act, NULL);
 
-	struct timespec csv_start;
-	if (csv) {
-		clock_gettime(CLOCK_MONOTONIC, &csv_start);
-	} else if (tty) {
-		/* clear the screen */
-		printf("\x1b[H\x1b[J");
-		/* hide the cursor */
-		printf("\x1b[?25l");
+	pid_t pid = -1;
+	if (options->command) {
+		act.sa_handler = sigchld_handler;
+		act.sa_flags = SA_NOCLDSTOP;
+		sigaction(SIGCHLD, &act, NULL);
+		pid = spawn_command(options->command);
+		if (pid < 0) {
+			render_free(render);
+			record_writer_free(writer);
+			stats_free(stats);
+			sampler_free(&sampler);
+			return false;
+		}
 	}
-	bool nl = false;
+
+	int count = 0;
 	while (!interrupted) {
-		if (!csv && tty) {
-			/* move the cursor */
-			printf("\x1b[H");
-		}
-		if (tty) {
-			nl = false;
-		}
-		if (csv) {
-			struct timespec csv_now;
-			clock_gettime(CLOCK_MONOTONIC, &csv_now);
-			double csv_diff = (csv_now.tv_sec - csv_start.tv_sec) +
-				(csv_now.tv_nsec - csv_start.tv_nsec) / 1000000000.;
-			bool nll = false;
-			CSV_SEPARATOR((bool *) &nl, nll);
-			printf("%.03f", csv_diff);
-		}
-		print_rapl(rapl, maxname, &nl, csv);
-		print_hwmon(coretemp, maxname, buf, degstr, &nl, csv);
-		print_cpufreq(maxname, buf, &nl, csv);
-		if (csv) {
-			printf("\n");
-		}
-		fflush(stdout);
-		if (!interrupted) {
-			nanosleep(&sleep_spec, NULL);
+		sampler_sample(&sampler);
+		stats_add(stats, sampler.frame);
+		count++;
+		if (writer && !record_write(writer, sampler.frame)) {
+			success = false;
+			break;
+		}
+		if (render) {
+			render_frame(render, sampler.frame);
+		}
+		if (child_exited ||
+			(options->count > 0 && count >= options->count) ||
+			(options->duration > 0 &&
+			sampler.frame->time >= options->duration)) {
+			break;
+		}
+		if (!interrupted && !child_exited) {
+			if (options->duration > 0 &&
+				sampler.frame->time + options->sleep > options->duration) {
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+					NULL);
+			} else {
+				ticker_wait(&ticker);
+			}
 		}
 	}
-	if (!csv && tty) {
-		/* show the cursor */
-		printf("\x1b[?25h");
+
+	if (pid > 0 && !wait_command(pid)) {
+		success = false;
+	}
+	if (render) {
+		render_summary(render, sampler.frame, stats);
+	}
+	render_free(render);
+	report_energy(&sampler);
+	if (ticker.missed > 0) {
+		fprintf(stderr, "Missed %ld ticks\n", ticker.missed);
+	}
+	record_writer_free(writer);
+	stats_free(stats);
+	sampler_free(&sampler);
+	return success;
+}
+
+bool convert_mode(const char * path) {
+	struct record_t * record = record_load(path);
+	struct render_t * render;
+	int i;
+
+	if (!record) {
+		return false;
+	}
+	render = render_init(RENDER_FORMAT_CSV_HEADER, record->frame, false);
+	if (!render) {
+		record_free(record);
+		return false;
 	}
+	for (i = 0; i < record->count; i++) {
+		record_get(record, i);
+		render_frame(render, record->frame);
+	}
+	render_free(render);
+	record_free(record);
+	return true;
+}
+
+bool replay_mode(const char * path, enum render_format format, float speed) {
+	struct record_t * record = record_load(path);
+	struct render_t * render;
+	struct timespec start;
+	struct timespec end;
+	struct timespec deadline;
+	double last = 0;
+	double interval = 0;
+	int i;
 
-	if (rapl) {
-		rapl_free(rapl);
+	if (!record) {
+		return false;
 	}
-	if (coretemp) {
-		array_free(coretemp);
+	render = render_init(format, record->frame, speed > 0);
+	if (!render) {
+		record_free(record);
+		return false;
 	}
 
+	interrupted = false;
+	struct sigaction act;
+	memset(&act, 0, sizeof(struct sigaction));
+	act.sa_handler = sigint_handler;
+	sigaction(SIGINT, &act, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	deadline = start;
+	for (i = 0; i < record->count && !interrupted; i++) {
+		record_get(record, i);
+		if (speed > 0) {
+			double delta = i > 0 ? record->frame->time - last : 0;
+			if (i > 0 && (delta < 0 ||
+				(interval > 0 && delta > REPLAY_MAX_GAP * interval))) {
+				/* gaps between appended runs are replayed as one interval */
+				delta = interval;
+			} else if (i > 0) {
+				interval = delta;
+			}
+			last = record->frame->time;
+			delta /= speed;
+			deadline.tv_sec += (time_t) delta;
+			deadline.tv_nsec += (long) ((delta - (time_t) delta) * 1000000000.);
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_nsec -= 1000000000;
+				deadline.tv_sec++;
+			}
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+		}
+		if (!interrupted) {
+			render_frame(render, record->frame);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	render_free(render);
+	if (speed <= 0) {
+		double elapsed = timespec_diff(&start, &end);
+		fprintf(stderr, "Rendered %d frames in %.03f s (%.0f frames/s)\n",
+			i, elapsed, elapsed > 0 ? i / elapsed : 0);
+	}
+	record_free(record);
 	return true;
 }
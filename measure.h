@@ -1,8 +1,42 @@
 #ifndef __MEASURE_H__
 #define __MEASURE_H__
 
+#include "power.h"
+#include "render.h"
+
 #include <stdbool.h>
 
-bool measure_mode(bool csv, float sleep);
+enum temperature_source {
+	TEMPERATURE_SOURCE_AUTO,
+	TEMPERATURE_SOURCE_HWMON,
+	TEMPERATURE_SOURCE_MSR
+};
+
+enum frequency_source {
+	FREQUENCY_SOURCE_AUTO,
+	FREQUENCY_SOURCE_SYSFS,
+	FREQUENCY_SOURCE_APERF
+};
+
+struct measure_options_t {
+	bool render;
+	enum render_format format;
+	float sleep;
+	const char * record;
+	enum rapl_source rapl_source;
+	enum temperature_source temperature_source;
+	enum frequency_source frequency_source;
+	bool cstates;
+	bool throttle;
+	bool voltage;
+	const char * sensors;
+	int count;
+	float duration;
+	char ** command;
+};
+
+bool measure_mode(struct measure_options_t * options);
+bool convert_mode(const char * path);
+bool replay_mode(const char * path, enum render_format format, float speed);
 
 #endif
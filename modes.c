@@ -1,5 +1,6 @@
 #include "config.h"
 #include "modes.h"
+#include "power.h"
 #include "scaling.h"
 #include "undervolt.h"
 
@@ -36,11 +37,25 @@ bool read_apply_mode(bool write, bool trigger) {
 }
 
 static bool reload_config;
+static bool print_energy;
 
 static void sigusr1_handler(UNUSED int sig) {
 	reload_config = true;
 }
 
+static void sigusr2_handler(UNUSED int sig) {
+	print_energy = true;
+}
+
+static void print_rapl_energy(struct rapl_t * rapl) {
+	int i;
+	for (i = 0; rapl && i < rapl->devices->count; i++) {
+		struct rapl_device_t * device = array_get(rapl->devices, i);
+		printf("%s: %.03f J\n", device->name, device->energy / 1000000.);
+	}
+	fflush(stdout);
+}
+
 int daemon_mode() {
 	struct config_t * config = load_config(NULL, NULL);
 	struct sigaction act;
@@ -49,6 +64,9 @@ int daemon_mode() {
 	bool power_done = false;
 	bool tjoffset_done = false;
 	struct cpu_policy_t * cpu_policy = NULL;
+	struct rapl_t * rapl = NULL;
+	struct ticker_t ticker;
+	long missed = 0;
 
 	if (config && config->interval <= 0) {
 		fprintf(stderr, "Interval is not specified\n");
@@ -60,16 +78,33 @@ int daemon_mode() {
 		memset(&act, 0, sizeof(struct sigaction));
 		act.sa_handler = sigusr1_handler;
 		sigaction(SIGUSR1, &act, NULL);
+		act.sa_handler = sigusr2_handler;
+		sigaction(SIGUSR2, &act, NULL);
 
 		reload_config = false;
+		print_energy = false;
+		/* energy is counted since the daemon was started */
+		rapl = rapl_init(config->rapl_source, NULL);
+		ticker_init(&ticker, (int64_t) config->interval * 1000000);
 		while (true) {
 			if (reload_config) {
+				int interval = config->interval;
 				reload_config = false;
 				printf("Reloading configuration\n");
 				config = load_config(config, NULL);
 				if (!config) {
 					break;
 				}
+				if (config->interval <= 0) {
+					fprintf(stderr, "Interval is not specified, keeping %d ms\n",
+						interval);
+					config->interval = interval;
+				}
+				ticker_set_interval(&ticker, (int64_t) config->interval * 1000000);
+			}
+
+			if (rapl) {
+				rapl_measure(rapl);
 			}
 
 			if (config->hwp_hints && !cpu_policy) {
@@ -107,20 +142,34 @@ int daemon_mode() {
 
 			if (cpu_policy) {
 				if (config->hwp_hints) {
-					cpu_policy_update(cpu_policy, config->hwp_hints);
+					cpu_policy_update(cpu_policy, config->hwp_hints, rapl,
+						config->hwp_revalidate);
 				} else {
 					cpu_policy_free(cpu_policy);
 					cpu_policy = NULL;
 				}
 			}
 
-			usleep(config->interval * 1000);
+			do {
+				if (print_energy) {
+					print_energy = false;
+					print_rapl_energy(rapl);
+					cpu_policy_print(cpu_policy);
+				}
+			} while (!ticker_wait(&ticker) && !reload_config);
+			if (ticker.missed > missed) {
+				fprintf(stderr, "Missed %ld ticks\n", ticker.missed - missed);
+				missed = ticker.missed;
+			}
 		}
 	}
 
 	if (cpu_policy) {
 		cpu_policy_free(cpu_policy);
 	}
+	if (rapl) {
+		rapl_free(rapl);
+	}
 
 	if (!config) {
 		fprintf(stderr, "Failed to setup the program\n");
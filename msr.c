@@ -0,0 +1,57 @@
+#include "msr.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+static bool msr_load_module() {
+	static bool loaded = false;
+	int status;
+	int pid;
+
+	if (loaded) {
+		return false;
+	}
+	loaded = true;
+	pid = fork();
+	if (pid < 0) {
+		perror("Fork failed");
+		return false;
+	} else if (pid == 0) {
+#ifdef IS_FREEBSD
+		char * executable = "/sbin/kldload";
+		execlp(executable, executable, "cpuctl", NULL);
+#else
+		char * executable = "/sbin/modprobe";
+		execlp(executable, executable, "msr", NULL);
+#endif
+		exit(1);
+	} else {
+		waitpid(pid, &status, 0);
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+}
+
+int msr_open(int cpu, bool write) {
+	char dev[PATH_MAX];
+	int flags = write ? O_RDWR | O_SYNC : O_RDONLY;
+	int fd;
+
+#ifdef IS_FREEBSD
+	snprintf(dev, sizeof(dev), "%s/dev/cpuctl%d", get_root(), cpu);
+#else
+	snprintf(dev, sizeof(dev), "%s/dev/cpu/%d/msr", get_root(), cpu);
+#endif
+	fd = open(dev, flags);
+	if (fd < 0 && errno == ENOENT && !get_root()[0]) {
+		if (msr_load_module()) {
+			fd = open(dev, flags);
+		} else {
+			errno = ENOENT;
+		}
+	}
+	return fd;
+}
@@ -0,0 +1,71 @@
+#ifndef __MSR_H__
+#define __MSR_H__
+
+#include "util.h"
+
+#ifdef IS_FREEBSD
+#include <sys/cpuctl.h>
+#include <sys/ioccom.h>
+#endif
+#include <unistd.h>
+
+#define MSR_ADDR_TSC 0x10
+#define MSR_ADDR_PLATFORM_INFO 0xce
+#define MSR_ADDR_MPERF 0xe7
+#define MSR_ADDR_APERF 0xe8
+#define MSR_ADDR_PERF_STATUS 0x198
+#define MSR_ADDR_THERM_STATUS 0x19c
+#define MSR_ADDR_PACKAGE_THERM_STATUS 0x1b1
+#define MSR_ADDR_TEMPERATURE 0x1a2
+#define MSR_ADDR_UNITS 0x606
+#define MSR_ADDR_VOLTAGE 0x150
+#define MSR_ADDR_CORE_C3_RESIDENCY 0x3fc
+#define MSR_ADDR_CORE_C6_RESIDENCY 0x3fd
+#define MSR_ADDR_CORE_C7_RESIDENCY 0x3fe
+#define MSR_ADDR_PKG_C2_RESIDENCY 0x60d
+#define MSR_ADDR_PKG_C3_RESIDENCY 0x3f8
+#define MSR_ADDR_PKG_C6_RESIDENCY 0x3f9
+#define MSR_ADDR_PKG_C7_RESIDENCY 0x3fa
+#define MSR_ADDR_PKG_C8_RESIDENCY 0x630
+#define MSR_ADDR_PKG_C9_RESIDENCY 0x631
+#define MSR_ADDR_PKG_C10_RESIDENCY 0x632
+#define MSR_ADDR_CORE_PERF_LIMIT_REASONS 0x64f
+#define MSR_ADDR_GRAPHICS_PERF_LIMIT_REASONS 0x6b0
+#define MSR_ADDR_RING_PERF_LIMIT_REASONS 0x6b1
+#define MSR_ADDR_PKG_ENERGY 0x611
+#define MSR_ADDR_DRAM_ENERGY 0x619
+#define MSR_ADDR_PP0_ENERGY 0x639
+#define MSR_ADDR_PP1_ENERGY 0x641
+
+#ifdef IS_FREEBSD
+
+static inline bool cpuctl_rd(int fd, int a, uint64_t * t) {
+	cpuctl_msr_args_t args;
+	args.msr = a;
+	if (ioctl(fd, CPUCTL_RDMSR, &args) == -1) {
+		return false;
+	}
+	*t = args.data;
+	return true;
+}
+
+static inline bool cpuctl_wr(int fd, int a, uint64_t * t) {
+	cpuctl_msr_args_t args;
+	args.msr = a;
+	args.data = *t;
+	return ioctl(fd, CPUCTL_WRMSR, &args) != -1;
+}
+
+#define msr_rd(fd, a, t) (cpuctl_rd((fd), (a), &(t)))
+#define msr_wr(fd, a, t) (cpuctl_wr((fd), (a), &(t)))
+
+#else
+
+#define msr_rd(fd, a, t) (pread((fd), &(t), 8, (a)) == 8)
+#define msr_wr(fd, a, t) (pwrite((fd), &(t), 8, (a)) == 8)
+
+#endif
+
+int msr_open(int cpu, bool write);
+
+#endif
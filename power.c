@@ -1,219 +1,441 @@
+#include "msr.h"
 #include "power.h"
+#include "sensor.h"
+#include "topology.h"
 #include "util.h"
 
+#include <cpuid.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
-#define DIR_POWERCAP "/sys/class/powercap"
 #define BUFSZ 80
 
 struct rapl_device_ext_t {
-	char * dir;
+	int sensor;
+	int fd_msr;
+	int msr_addr;
+	bool started;
 	int64_t last;
+	int64_t range;
+	double scale;
 	struct timespec time;
 };
 
 struct rapl_full_t {
 	struct rapl_t parent;
 	struct array_t * exts;
+	struct sensors_t * sensors;
+	struct topology_t * topology;
 };
 
+static struct power_msr_domain_t {
+	const char * name;
+	int msr_addr;
+} power_msr_domains[] = {
+	{ "package", MSR_ADDR_PKG_ENERGY },
+	{ "core", MSR_ADDR_PP0_ENERGY },
+	{ "uncore", MSR_ADDR_PP1_ENERGY },
+	{ "dram", MSR_ADDR_DRAM_ENERGY }
+};
+
+/* server models count DRAM energy in fixed 15.3 uJ units, the energy status
+ * unit of MSR_RAPL_POWER_UNIT doesn't apply to them */
+#define DRAM_SERVER_SCALE 15.3
+
+static const int power_dram_server_models[] = {
+	0x3f, /* Haswell-X */
+	0x4f, /* Broadwell-X */
+	0x55, /* Skylake-X */
+	0x56, /* Broadwell-D */
+	0x57, /* Knights Landing */
+	0x6a, /* Ice Lake-X */
+	0x6c, /* Ice Lake-D */
+	0x85, /* Knights Mill */
+	0x8f, /* Sapphire Rapids-X */
+	0xad, /* Granite Rapids-X */
+	0xae, /* Granite Rapids-D */
+	0xcf /* Emerald Rapids-X */
+};
+
+static bool dram_server_unit() {
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int model;
+	unsigned int i;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || ((eax >> 8) & 0xf) != 6) {
+		return false;
+	}
+	model = ((eax >> 4) & 0xf) | ((eax >> 12) & 0xf0);
+	for (i = 0; i < ARRAY_SIZE(power_dram_server_models); i++) {
+		if ((unsigned int) power_dram_server_models[i] == model) {
+			return true;
+		}
+	}
+	return false;
+}
+
 static void rapl_device_free(void * pointer) {
 	struct rapl_device_t * device = pointer;
 	free(device->name);
 }
 
-static void rapl_device_ext_free(void * pointer) {
-	struct rapl_device_ext_t * ext = pointer;
-	free(ext->dir);
+void rapl_free(struct rapl_t * rapl) {
+	if (rapl) {
+		struct rapl_full_t * full = (struct rapl_full_t *) rapl;
+		if (full->parent.devices) {
+			array_free(full->parent.devices);
+		}
+		if (full->exts) {
+			array_free(full->exts);
+		}
+		sensors_free(full->sensors);
+		topology_free(full->topology);
+		free(full);
+	}
+}
+
+static struct rapl_full_t * rapl_new() {
+	struct rapl_full_t * full = malloc(sizeof(struct rapl_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.devices = array_new(sizeof(struct rapl_device_t),
+		rapl_device_free);
+	full->exts = array_new(sizeof(struct rapl_device_ext_t), NULL);
+	full->sensors = NULL;
+	full->topology = NULL;
+	if (!full->parent.devices || !full->exts) {
+		rapl_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	return full;
 }
 
-struct rapl_t * rapl_init() {
+static struct rapl_device_ext_t * rapl_add(struct rapl_full_t * full,
+	const char * name) {
+	struct rapl_device_t * device;
+	struct rapl_device_ext_t * ext;
+	int length = strlen(name);
+	char * copy = malloc(length + 1);
+
+	if (!copy) {
+		return NULL;
+	}
+	memcpy(copy, name, length + 1);
+	device = array_add(full->parent.devices);
+	if (!device) {
+		free(copy);
+		return NULL;
+	}
+	device->name = copy;
+	/* power is unknown until two samples are taken */
+	device->power = NAN;
+	device->energy = 0;
+
+	ext = array_add(full->exts);
+	if (!ext) {
+		full->parent.devices->count--;
+		free(copy);
+		return NULL;
+	}
+	ext->sensor = -1;
+	ext->fd_msr = -1;
+	ext->msr_addr = 0;
+	ext->started = false;
+	ext->last = 0;
+	ext->range = 0;
+	ext->scale = 1;
+	ext->time.tv_sec = 0;
+	ext->time.tv_nsec = 0;
+	return ext;
+}
+
+static int64_t read_range(const char * dir) {
+	char path[PATH_MAX];
+	char buf[BUFSZ];
+	int64_t range = 0;
+	int fd;
+	snprintf(path, sizeof(path), "%s" DIR_POWERCAP "/%s/max_energy_range_uj",
+		get_root(), dir);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		int size = read(fd, buf, BUFSZ - 1);
+		if (size > 0) {
+			buf[size] = '\0';
+			range = (int64_t) atoll(buf);
+		}
+		close(fd);
+	}
+	return range;
+}
+
+/* Returns NULL when no devices are found, or an empty set when all of them
+ * are filtered out. */
+static struct rapl_full_t * rapl_init_sysfs(struct filter_t * filter,
+	bool verbose) {
+	char path[PATH_MAX];
 	char buf[BUFSZ];
 	DIR * dir;
 	struct dirent * dirent;
-	struct array_t * devices = NULL;
-	struct array_t * exts = NULL;
 	bool nomem = false;
-	struct rapl_full_t * full = NULL;
+	bool filtered = false;
+	bool multi_package;
+	struct rapl_full_t * full;
+
+	/* subzones of different packages have the same names */
+	snprintf(path, sizeof(path), "%s" DIR_POWERCAP "/intel-rapl:1",
+		get_root());
+	multi_package = access(path, F_OK) == 0;
 
-	dir = opendir(DIR_POWERCAP);
+	snprintf(path, sizeof(path), "%s" DIR_POWERCAP, get_root());
+	dir = opendir(path);
 	if (dir == NULL) {
-		fprintf(stderr, "Failed to open powercap directory\n");
+		if (verbose) {
+			fprintf(stderr, "Failed to open powercap directory\n");
+		}
+		return NULL;
+	}
+
+	full = rapl_new();
+	if (full) {
+		full->sensors = sensors_init();
+	}
+	if (!full || !full->sensors) {
+		if (full) {
+			rapl_free(&full->parent);
+		}
+		closedir(dir);
 		return NULL;
 	}
 
 	while ((dirent = readdir(dir))) {
 		if (strstr(dirent->d_name, ":") && strlen(dirent->d_name) <= 30) {
 			int fd;
-BEGIN_IGNORE_FORMAT_OVERFLOW
-			sprintf(buf, DIR_POWERCAP "/%s/name", dirent->d_name);
-END_IGNORE_FORMAT_OVERFLOW
-			fd = open(buf, O_RDONLY);
+			snprintf(path, sizeof(path), "%s" DIR_POWERCAP "/%s/name",
+				get_root(), dirent->d_name);
+			fd = open(path, O_RDONLY);
 			if (fd >= 0) {
 				int size = read(fd, buf, BUFSZ - 1);
+				close(fd);
 				if (size >= 1) {
-					struct rapl_device_t * device;
 					struct rapl_device_ext_t * ext;
-					char * name;
-					char * dir;
 					int name_length;
-					int dir_length;
 
 					name_length = buf[size - 1] == '\n' ? size - 1 : size;
 					buf[name_length] = '\0';
 					if (name_length == 0) {
-						close(fd);
 						continue;
 					}
-					name = malloc(name_length + 1);
-					if (!name) {
-						close(fd);
-						nomem = true;
-						break;
-					}
-					memcpy(name, buf, name_length + 1);
-
-					dir_length = strlen(dirent->d_name);
-					dir = malloc(dir_length + 1);
-					if (!dir) {
-						free(name);
-						close(fd);
-						nomem = true;
-						break;
-					}
-					memcpy(dir, dirent->d_name, dir_length + 1);
-
-					if (!devices && !exts) {
-						devices = array_new(sizeof(struct rapl_device_t),
-							rapl_device_free);
-						exts = array_new(sizeof(struct rapl_device_ext_t),
-							rapl_device_ext_free);
-						if (!devices || !exts) {
-							free(name);
-							free(dir);
-							close(fd);
-							nomem = true;
-							break;
-						}
+					if (multi_package && !strncmp(dirent->d_name,
+						"intel-rapl:", 11) && strchr(&dirent->d_name[11], ':')) {
+						sprintf(&buf[name_length], "-%d",
+							atoi(&dirent->d_name[11]));
 					}
-
-					device = array_add(devices);
-					if (!device) {
-						free(name);
-						free(dir);
-						close(fd);
-						nomem = true;
-						break;
+					if (!filter_match(filter, buf)) {
+						filtered = true;
+						continue;
 					}
-					device->name = name;
-					device->power = 0;
-
-					ext = array_add(exts);
+					ext = rapl_add(full, buf);
 					if (!ext) {
-						free(dir);
-						close(fd);
 						nomem = true;
 						break;
 					}
-					ext->dir = dir;
-					ext->last = 0;
-					ext->time.tv_sec = 0;
-					ext->time.tv_nsec = 0;
+					snprintf(path, sizeof(path), "%s" DIR_POWERCAP "/%s/energy_uj",
+						get_root(), dirent->d_name);
+					ext->sensor = sensors_add(full->sensors, path);
+					ext->range = read_range(dirent->d_name);
 				}
-				close(fd);
 			}
 		}
 	}
-
 	closedir(dir);
-	if (!nomem) {
-		full = malloc(sizeof(struct rapl_full_t));
-		if (!full) {
-			nomem = true;
+
+	if (nomem) {
+		rapl_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	} else if (full->parent.devices->count == 0 && !filtered) {
+		rapl_free(&full->parent);
+		if (verbose) {
+			fprintf(stderr, "No RAPL devices found in powercap directory\n");
 		}
+		return NULL;
 	}
+	return full;
+}
 
-	if (nomem) {
-		if (devices) {
-			array_free(devices);
+static struct rapl_full_t * rapl_init_msr(struct filter_t * filter) {
+	struct rapl_full_t * full;
+	bool filtered = false;
+	bool dram_server = dram_server_unit();
+	char buf[BUFSZ];
+	int i;
+
+	full = rapl_new();
+	if (!full) {
+		return NULL;
+	}
+	full->topology = topology_init();
+	if (!full->topology) {
+		rapl_free(&full->parent);
+		return NULL;
+	}
+
+	for (i = 0; i < full->topology->cpus->count; i++) {
+		struct topology_cpu_t * cpu = array_get(full->topology->cpus, i);
+		uint64_t units;
+		double scale;
+		unsigned int j;
+		int fd;
+
+		if (!cpu->first_in_package) {
+			continue;
 		}
-		if (exts) {
-			array_free(exts);
+		fd = topology_msr(cpu);
+		if (fd < 0) {
+			perror("Failed to open MSR device");
+			rapl_free(&full->parent);
+			return NULL;
 		}
-		if (full) {
-			free(full);
+		if (!msr_rd(fd, MSR_ADDR_UNITS, units)) {
+			perror("Failed to read RAPL units");
+			rapl_free(&full->parent);
+			return NULL;
 		}
-		fprintf(stderr, "No enough memory\n");
+		/* energy status unit is 1 / 2 ^ ESU joules */
+		scale = 1000000. / exp2((units >> 8) & 0x1f);
+
+		for (j = 0; j < ARRAY_SIZE(power_msr_domains); j++) {
+			struct rapl_device_ext_t * ext;
+			uint64_t value;
+			/* unsupported domains fail to read */
+			if (!msr_rd(fd, power_msr_domains[j].msr_addr, value)) {
+				continue;
+			}
+			/* match the names used by powercap */
+			if (power_msr_domains[j].msr_addr == MSR_ADDR_PKG_ENERGY) {
+				sprintf(buf, "package-%d", cpu->package);
+			} else if (full->topology->package_count > 1) {
+				sprintf(buf, "%s-%d", power_msr_domains[j].name, cpu->package);
+			} else {
+				strcpy(buf, power_msr_domains[j].name);
+			}
+			if (!filter_match(filter, buf)) {
+				filtered = true;
+				continue;
+			}
+			ext = rapl_add(full, buf);
+			if (!ext) {
+				rapl_free(&full->parent);
+				fprintf(stderr, "No enough memory\n");
+				return NULL;
+			}
+			ext->fd_msr = fd;
+			ext->msr_addr = power_msr_domains[j].msr_addr;
+			ext->range = (int64_t) 1 << 32;
+			ext->scale = dram_server && power_msr_domains[j].msr_addr ==
+				MSR_ADDR_DRAM_ENERGY ? DRAM_SERVER_SCALE : scale;
+		}
+	}
+
+	if (full->parent.devices->count == 0 && !filtered) {
+		rapl_free(&full->parent);
+		fprintf(stderr, "No RAPL MSR domains available\n");
 		return NULL;
-	} else {
-		array_shrink(devices);
-		array_shrink(exts);
-		full->parent.devices = devices;
-		full->exts = exts;
+	}
+	return full;
+}
+
+struct rapl_t * rapl_init(enum rapl_source source, struct filter_t * filter) {
+	struct rapl_full_t * full = NULL;
+
+	if (source != RAPL_SOURCE_MSR) {
+		full = rapl_init_sysfs(filter, source == RAPL_SOURCE_SYSFS);
+	}
+	if (!full && source != RAPL_SOURCE_SYSFS) {
+		full = rapl_init_msr(filter);
+	}
+
+	if (full && full->parent.devices->count == 0) {
+		rapl_free(&full->parent);
+		return NULL;
+	} else if (full) {
+		array_shrink(full->parent.devices);
+		array_shrink(full->exts);
 		return &full->parent;
+	} else {
+		return NULL;
+	}
+}
+
+static bool rapl_read(struct rapl_full_t * full, struct rapl_device_ext_t * ext,
+	int64_t * value) {
+	if (ext->msr_addr != 0) {
+		uint64_t raw;
+		if (msr_rd(ext->fd_msr, ext->msr_addr, raw)) {
+			*value = (int64_t) (raw & 0xffffffff);
+			return true;
+		}
+		return false;
+	} else {
+		return sensors_value(full->sensors, ext->sensor, value);
 	}
 }
 
 void rapl_measure(struct rapl_t * rapl) {
 	if (rapl) {
-		char buf[BUFSZ];
 		struct rapl_full_t * full = (struct rapl_full_t *) rapl;
+		struct timespec tnow;
 		int i;
 
+		sensors_read(full->sensors);
+		clock_gettime(CLOCK_MONOTONIC, &tnow);
+
 		for (i = 0; i < full->parent.devices->count; i++) {
-			int fd;
 			struct rapl_device_t * device = array_get(full->parent.devices, i);
 			struct rapl_device_ext_t * ext = array_get(full->exts, i);
-			sprintf(buf, DIR_POWERCAP "/%s/energy_uj", ext->dir);
-			fd = open(buf, O_RDONLY);
-			if (fd >= 0) {
-				int size = read(fd, buf, BUFSZ - 1);
-				if (size > 0) {
-					struct timespec tnow;
-					double power = 0;
-					buf[buf[size - 1] == '\n' ? size - 1 : size] = '\0';
-					int64_t value = (int64_t) atoll(buf);
-					clock_gettime(CLOCK_MONOTONIC, &tnow);
-					if (ext->last > 0 && value >= ext->last) {
-						struct timespec tdiff;
-						int64_t diff;
-						tdiff.tv_sec = tnow.tv_sec - ext->time.tv_sec;
-						tdiff.tv_nsec = tnow.tv_nsec - ext->time.tv_nsec;
-						while (tdiff.tv_nsec < 0) {
-							tdiff.tv_nsec += 1000000000;
-							tdiff.tv_sec--;
-						}
-						diff = (int64_t) (tdiff.tv_sec * 1000000000 +
-							tdiff.tv_nsec);
-						power = (double) (value - ext->last) * 1000 / diff;
-					} else {
-						power = device->power;
+			int64_t value;
+			if (rapl_read(full, ext, &value)) {
+				double power = 0;
+				int64_t delta = -1;
+				if (ext->started && value >= ext->last) {
+					delta = value - ext->last;
+				} else if (ext->started && ext->range > 0 &&
+					value <= ext->range && ext->last <= ext->range) {
+					/* the counter wrapped around */
+					delta = ext->range - ext->last + value;
+				}
+				if (delta >= 0) {
+					struct timespec tdiff;
+					int64_t diff;
+					double energy = delta * ext->scale;
+					tdiff.tv_sec = tnow.tv_sec - ext->time.tv_sec;
+					tdiff.tv_nsec = tnow.tv_nsec - ext->time.tv_nsec;
+					while (tdiff.tv_nsec < 0) {
+						tdiff.tv_nsec += 1000000000;
+						tdiff.tv_sec--;
 					}
-					ext->last = value;
-					ext->time = tnow;
-					device->power = power;
+					diff = (int64_t) (tdiff.tv_sec * 1000000000 +
+						tdiff.tv_nsec);
+					power = diff > 0 ? energy * 1000 / diff : device->power;
+					device->energy += (uint64_t) (energy + 0.5);
+				} else {
+					power = device->power;
 				}
-				close(fd);
+				ext->started = true;
+				ext->last = value;
+				ext->time = tnow;
+				device->power = power;
 			}
 		}
 	}
 }
-
-void rapl_free(struct rapl_t * rapl) {
-	if (rapl) {
-		struct rapl_full_t * full = (struct rapl_full_t *) rapl;
-		if (full->parent.devices) {
-			array_free(full->parent.devices);
-		}
-		if (full->exts) {
-			array_free(full->exts);
-		}
-		free(full);
-	}
-}
@@ -1,18 +1,29 @@
 #ifndef __POWER_H__
 #define __POWER_H__
 
+#include "filter.h"
 #include "util.h"
 
+#define DIR_POWERCAP "/sys/class/powercap"
+
 struct rapl_device_t {
 	char * name;
 	float power;
+	/* microjoules consumed since the first measurement */
+	uint64_t energy;
 };
 
 struct rapl_t {
 	struct array_t * devices;
 };
 
-struct rapl_t * rapl_init();
+enum rapl_source {
+	RAPL_SOURCE_AUTO,
+	RAPL_SOURCE_SYSFS,
+	RAPL_SOURCE_MSR
+};
+
+struct rapl_t * rapl_init(enum rapl_source source, struct filter_t * filter);
 void rapl_measure(struct rapl_t * rapl);
 void rapl_free(struct rapl_t * rapl);
 
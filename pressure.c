@@ -0,0 +1,132 @@
+#include "pressure.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_PRESSURE "/proc/pressure/cpu"
+#define BUFSZ 256
+
+struct pressure_full_t {
+	struct pressure_t parent;
+	int fd;
+	bool started;
+	uint64_t total;
+	struct timespec time;
+	char buf[BUFSZ];
+};
+
+static void pressure_reset(struct pressure_t * pressure) {
+	pressure->avg10 = 0;
+	pressure->avg60 = 0;
+	pressure->avg300 = 0;
+	pressure->interval = 0;
+}
+
+struct pressure_t * pressure_init(bool verbose) {
+	struct pressure_full_t * full;
+	char path[PATH_MAX];
+
+	full = malloc(sizeof(struct pressure_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	pressure_reset(&full->parent);
+	full->started = false;
+	full->total = 0;
+
+	snprintf(path, sizeof(path), "%s" FILE_PRESSURE, get_root());
+	full->fd = open(path, O_RDONLY);
+	if (full->fd < 0) {
+		if (verbose) {
+			perror("Failed to open " FILE_PRESSURE);
+		}
+		free(full);
+		return NULL;
+	}
+	return &full->parent;
+}
+
+/* Parses "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" line. */
+static bool pressure_parse(struct pressure_full_t * full, uint64_t * total) {
+	char * p = full->buf;
+	char * end;
+
+	if (strncmp(p, "some ", 5)) {
+		return false;
+	}
+	p += 5;
+	while (*p && *p != '\n') {
+		char * value = strchr(p, '=');
+		if (!value) {
+			return false;
+		}
+		value++;
+		if (!strncmp(p, "avg10=", 6)) {
+			full->parent.avg10 = strtof(value, &end);
+		} else if (!strncmp(p, "avg60=", 6)) {
+			full->parent.avg60 = strtof(value, &end);
+		} else if (!strncmp(p, "avg300=", 7)) {
+			full->parent.avg300 = strtof(value, &end);
+		} else if (!strncmp(p, "total=", 6)) {
+			*total = strtoull(value, &end, 10);
+		} else {
+			end = value + strcspn(value, " \n");
+		}
+		p = end;
+		while (*p == ' ') {
+			p++;
+		}
+	}
+	return true;
+}
+
+void pressure_measure(struct pressure_t * pressure) {
+	if (pressure) {
+		struct pressure_full_t * full = (struct pressure_full_t *) pressure;
+		struct timespec now;
+		uint64_t total = 0;
+		ssize_t size;
+
+		size = pread(full->fd, full->buf, BUFSZ - 1, 0);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (size <= 0) {
+			pressure_reset(pressure);
+			full->started = false;
+			return;
+		}
+		full->buf[size] = '\0';
+		if (!pressure_parse(full, &total)) {
+			pressure_reset(pressure);
+			full->started = false;
+			return;
+		}
+
+		if (full->started && total >= full->total) {
+			/* total is stall time in microseconds */
+			double interval = (now.tv_sec - full->time.tv_sec) * 1000000. +
+				(now.tv_nsec - full->time.tv_nsec) / 1000.;
+			pressure->interval = interval > 0
+				? 100. * (total - full->total) / interval : 0;
+		} else {
+			pressure->interval = 0;
+		}
+		full->started = true;
+		full->total = total;
+		full->time = now;
+	}
+}
+
+void pressure_free(struct pressure_t * pressure) {
+	if (pressure) {
+		struct pressure_full_t * full = (struct pressure_full_t *) pressure;
+		close(full->fd);
+		free(full);
+	}
+}
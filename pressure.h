@@ -0,0 +1,20 @@
+#ifndef __PRESSURE_H__
+#define __PRESSURE_H__
+
+#include <stdbool.h>
+
+struct pressure_t {
+	/* share of time in percent some runnable tasks were stalled,
+	 * kernel averages over 10, 60 and 300 seconds */
+	float avg10;
+	float avg60;
+	float avg300;
+	/* same share over the last interval, computed from total stall time */
+	float interval;
+};
+
+struct pressure_t * pressure_init(bool verbose);
+void pressure_measure(struct pressure_t * pressure);
+void pressure_free(struct pressure_t * pressure);
+
+#endif
@@ -0,0 +1,277 @@
+#include "record.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* File layout, native byte order:
+ * header, column_count * column, then fixed-size records until EOF.
+ * Record: double time (wall clock seconds), float skew, float values[],
+ * padded to 8 bytes. */
+
+#define RECORD_MAGIC "IUVREC\0\0"
+#define RECORD_VERSION 1
+#define RECORD_NAME_SIZE 60
+
+struct record_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t column_count;
+	uint32_t header_size;
+	uint32_t record_size;
+};
+
+struct record_column_t {
+	char name[RECORD_NAME_SIZE];
+	uint32_t unit;
+};
+
+struct record_entry_t {
+	double time;
+	float skew;
+	float values[];
+};
+
+struct record_writer_t {
+	int fd;
+	uint32_t record_size;
+	struct record_entry_t * entry;
+};
+
+struct record_full_t {
+	struct record_t parent;
+	void * map;
+	size_t size;
+	uint32_t header_size;
+	uint32_t record_size;
+};
+
+static size_t record_size(size_t column_count) {
+	size_t size = sizeof(struct record_entry_t) + column_count * sizeof(float);
+	return (size + 7) & ~(size_t) 7;
+}
+
+static size_t header_size(size_t column_count) {
+	return sizeof(struct record_header_t) +
+		column_count * sizeof(struct record_column_t);
+}
+
+static void * make_header(struct frame_t * frame) {
+	int count = frame->columns->count;
+	struct record_header_t * header = calloc(1, header_size(count));
+	struct record_column_t * columns;
+	int i;
+
+	if (!header) {
+		return NULL;
+	}
+	memcpy(header->magic, RECORD_MAGIC, sizeof(header->magic));
+	header->version = RECORD_VERSION;
+	header->column_count = count;
+	header->header_size = header_size(count);
+	header->record_size = record_size(count);
+	columns = (struct record_column_t *) &header[1];
+	for (i = 0; i < count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		strncpy(columns[i].name, column->name, RECORD_NAME_SIZE - 1);
+		columns[i].unit = column->unit;
+	}
+	return header;
+}
+
+struct record_writer_t * record_writer_init(const char * path,
+	struct frame_t * frame) {
+	struct record_writer_t * writer;
+	struct record_header_t * header;
+	struct stat st;
+	int fd;
+
+	header = make_header(frame);
+	writer = malloc(sizeof(struct record_writer_t));
+	if (writer) {
+		writer->entry = calloc(1, header ? header->record_size : 1);
+	}
+	if (!header || !writer || !writer->entry) {
+		if (writer) {
+			free(writer->entry);
+			free(writer);
+		}
+		free(header);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	writer->record_size = header->record_size;
+
+	fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror("Failed to open record file");
+	} else if (st.st_size == 0) {
+		if (write(fd, header, header->header_size) !=
+			(ssize_t) header->header_size) {
+			perror("Failed to write record file");
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		void * old = malloc(header->header_size);
+		off_t tail;
+		if (!old) {
+			fprintf(stderr, "No enough memory\n");
+			close(fd);
+			fd = -1;
+		} else if (pread(fd, old, header->header_size, 0) !=
+			(ssize_t) header->header_size ||
+			memcmp(old, header, header->header_size)) {
+			fprintf(stderr, "Record file has different columns\n");
+			close(fd);
+			fd = -1;
+		} else {
+			/* drop a partial record left by an interrupted writer */
+			tail = (st.st_size - header->header_size) % header->record_size;
+			if (tail != 0 && ftruncate(fd, st.st_size - tail) < 0) {
+				perror("Failed to write record file");
+				close(fd);
+				fd = -1;
+			}
+		}
+		free(old);
+	}
+
+	free(header);
+	if (fd < 0) {
+		free(writer->entry);
+		free(writer);
+		return NULL;
+	}
+	writer->fd = fd;
+	return writer;
+}
+
+bool record_write(struct record_writer_t * writer, struct frame_t * frame) {
+	writer->entry->time = frame->epoch + frame->time;
+	writer->entry->skew = frame->skew;
+	memcpy(writer->entry->values, frame->values,
+		frame->columns->count * sizeof(float));
+	if (write(writer->fd, writer->entry, writer->record_size) !=
+		(ssize_t) writer->record_size) {
+		perror("Failed to write record file");
+		return false;
+	}
+	return true;
+}
+
+void record_writer_free(struct record_writer_t * writer) {
+	if (writer) {
+		close(writer->fd);
+		free(writer->entry);
+		free(writer);
+	}
+}
+
+struct record_t * record_load(const char * path) {
+	struct record_full_t * full;
+	struct record_header_t * header;
+	struct record_column_t * columns;
+	struct stat st;
+	void * map;
+	uint32_t i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror("Failed to open record file");
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	if ((size_t) st.st_size < sizeof(struct record_header_t)) {
+		fprintf(stderr, "Invalid record file\n");
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("Mmap failed");
+		return NULL;
+	}
+
+	header = map;
+	/* the column count is checked first so sizes can not overflow */
+	if (memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) ||
+		header->version != RECORD_VERSION ||
+		header->column_count > (st.st_size - sizeof(struct record_header_t)) /
+			sizeof(struct record_column_t) ||
+		header->header_size != header_size(header->column_count) ||
+		header->record_size != record_size(header->column_count) ||
+		(size_t) st.st_size < header->header_size) {
+		fprintf(stderr, "Invalid record file\n");
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	full = malloc(sizeof(struct record_full_t));
+	if (!full || !(full->parent.frame = frame_init())) {
+		if (full) {
+			free(full);
+		}
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	columns = (struct record_column_t *) &header[1];
+	for (i = 0; i < header->column_count; i++) {
+		char name[RECORD_NAME_SIZE];
+		memcpy(name, columns[i].name, RECORD_NAME_SIZE - 1);
+		name[RECORD_NAME_SIZE - 1] = '\0';
+		if (frame_add_column(full->parent.frame, name, columns[i].unit) < 0) {
+			break;
+		}
+	}
+	if (i < header->column_count || !frame_alloc(full->parent.frame)) {
+		fprintf(stderr, "No enough memory\n");
+		frame_free(full->parent.frame);
+		free(full);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	full->map = map;
+	full->size = st.st_size;
+	full->header_size = header->header_size;
+	full->record_size = header->record_size;
+	full->parent.count = (st.st_size - header->header_size) /
+		header->record_size;
+	if (full->parent.count > 0) {
+		struct record_entry_t * first = (struct record_entry_t *)
+			((char *) map + full->header_size);
+		full->parent.frame->epoch = first->time;
+	}
+	return &full->parent;
+}
+
+void record_get(struct record_t * record, int index) {
+	struct record_full_t * full = (struct record_full_t *) record;
+	struct frame_t * frame = record->frame;
+	struct record_entry_t * entry = (struct record_entry_t *)
+		((char *) full->map + full->header_size +
+		(size_t) index * full->record_size);
+	frame->time = entry->time - frame->epoch;
+	frame->skew = entry->skew;
+	memcpy(frame->values, entry->values,
+		frame->columns->count * sizeof(float));
+}
+
+void record_free(struct record_t * record) {
+	if (record) {
+		struct record_full_t * full = (struct record_full_t *) record;
+		frame_free(record->frame);
+		munmap(full->map, full->size);
+		free(full);
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include "frame.h"
+
+struct record_writer_t;
+
+struct record_writer_t * record_writer_init(const char * path,
+	struct frame_t * frame);
+bool record_write(struct record_writer_t * writer, struct frame_t * frame);
+void record_writer_free(struct record_writer_t * writer);
+
+struct record_t {
+	struct frame_t * frame;
+	int count;
+};
+
+struct record_t * record_load(const char * path);
+void record_get(struct record_t * record, int index);
+void record_free(struct record_t * record);
+
+#endif
@@ -0,0 +1,478 @@
+#include "render.h"
+#include "util.h"
+
+#include <errno.h>
+#include <iconv.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FLAGS_BUFSZ 256
+
+/* Screen is a grid of rows with fixed width, every frame is composed into
+ * the next grid and only changed cells are sent to the terminal. */
+struct screen_t {
+	int rows;
+	int width;
+	int * column_rows;
+	char * current;
+	char * next;
+	char * out;
+	size_t out_size;
+};
+
+struct render_t {
+	const struct render_ops_t * ops;
+	bool tty;
+	bool live;
+	int maxname;
+	int frames;
+	char degstr[5];
+	struct screen_t * screen;
+};
+
+struct render_ops_t {
+	void (* begin)(struct render_t * render, struct frame_t * frame);
+	void (* frame)(struct render_t * render, struct frame_t * frame);
+	void (* end)(struct render_t * render);
+	void (* summary)(struct render_t * render, struct frame_t * frame,
+		struct stats_t * stats);
+};
+
+static const char * unit_suffix(struct render_t * render, enum frame_unit unit) {
+	switch (unit) {
+		case FRAME_UNIT_POWER:
+			return " W";
+		case FRAME_UNIT_TEMPERATURE:
+			return render->degstr;
+		case FRAME_UNIT_FREQUENCY:
+			return " MHz";
+		case FRAME_UNIT_ENERGY:
+			return " J";
+		case FRAME_UNIT_PERCENT:
+			return " %";
+		case FRAME_UNIT_FLAGS:
+			return "";
+		case FRAME_UNIT_VOLTAGE:
+			return " V";
+	}
+	return "";
+}
+
+static void write_maxname(const char * name, int maxname) {
+	int len = strlen(name);
+	int i;
+	printf("%s:", name);
+	for (i = len - 1; i < maxname; i++) {
+		printf(" ");
+	}
+}
+
+static const char * format_flags(char * buf, float value,
+	const char * separator, const char * empty) {
+	uint32_t flags = (uint32_t) value;
+	int length = 0;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < FRAME_FLAG_COUNT; i++) {
+		if ((flags >> i) & 0x1) {
+			length += snprintf(&buf[length], FLAGS_BUFSZ - length, "%s%s",
+				length > 0 ? separator : "", frame_flag_name(i));
+		}
+	}
+	return length > 0 ? buf : empty;
+}
+
+static void write_flags(float value, const char * separator,
+	const char * empty) {
+	char buf[FLAGS_BUFSZ];
+	printf("%s", format_flags(buf, value, separator, empty));
+}
+
+static void screen_free(struct screen_t * screen) {
+	if (screen) {
+		free(screen->column_rows);
+		free(screen->current);
+		free(screen->next);
+		free(screen->out);
+		free(screen);
+	}
+}
+
+static struct screen_t * screen_init(struct render_t * render,
+	struct frame_t * frame) {
+	struct screen_t * screen = calloc(1, sizeof(struct screen_t));
+	char buf[FLAGS_BUFSZ];
+	size_t size;
+	int i;
+
+	if (!screen) {
+		return NULL;
+	}
+	/* widest value is either a number or all flags together */
+	screen->width = render->maxname + 2 + 9 + sizeof(render->degstr);
+	i = strlen(format_flags(buf, (1 << FRAME_FLAG_COUNT) - 1, ", ", ""));
+	if (render->maxname + 2 + i > screen->width) {
+		screen->width = render->maxname + 2 + i;
+	}
+	screen->column_rows = malloc((frame->columns->count > 0
+		? frame->columns->count : 1) * sizeof(int));
+	if (!screen->column_rows) {
+		screen_free(screen);
+		return NULL;
+	}
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		if (i > 0 && column->unit !=
+			((struct frame_column_t *) array_get(frame->columns, i - 1))->unit) {
+			/* empty line between units */
+			screen->rows++;
+		}
+		screen->column_rows[i] = screen->rows++;
+	}
+
+	size = (size_t) (screen->rows > 0 ? screen->rows : 1) * screen->width;
+	screen->current = malloc(size);
+	screen->next = malloc(size);
+	/* worst case is an escape sequence before every merged run */
+	screen->out_size = 3 * size + 32;
+	screen->out = malloc(screen->out_size);
+	if (!screen->current || !screen->next || !screen->out) {
+		screen_free(screen);
+		return NULL;
+	}
+	/* the screen is cleared in terminal_begin */
+	memset(screen->current, ' ', size);
+	return screen;
+}
+
+static void screen_compose(struct render_t * render, struct frame_t * frame) {
+	struct screen_t * screen = render->screen;
+	char buf[FLAGS_BUFSZ];
+	int i;
+
+	memset(screen->next, ' ', (size_t) screen->rows * screen->width);
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		char * row = &screen->next[(size_t) screen->column_rows[i] *
+			screen->width];
+		char line[FLAGS_BUFSZ + 80];
+		int length;
+
+		if (isnan(frame->values[i])) {
+			length = snprintf(line, sizeof(line), "%s:", column->name);
+		} else if (column->unit == FRAME_UNIT_FLAGS) {
+			length = snprintf(line, sizeof(line), "%-*s%s",
+				render->maxname + 2, column->name,
+				format_flags(buf, frame->values[i], ", ", "none"));
+			/* the name is padded after the colon */
+			line[strlen(column->name)] = ':';
+		} else {
+			length = snprintf(line, sizeof(line), "%-*s%9.03f%s",
+				render->maxname + 2, column->name, frame->values[i],
+				unit_suffix(render, column->unit));
+			line[strlen(column->name)] = ':';
+		}
+		if (length > screen->width) {
+			length = screen->width;
+		}
+		memcpy(row, line, length);
+	}
+}
+
+static void screen_write(struct screen_t * screen) {
+	size_t length = 0;
+	size_t written = 0;
+	int row;
+
+	for (row = 0; row < screen->rows; row++) {
+		char * current = &screen->current[(size_t) row * screen->width];
+		char * next = &screen->next[(size_t) row * screen->width];
+		int column = 0;
+
+		while (column < screen->width) {
+			int start;
+			int end;
+			int gap;
+			int cells;
+			int j;
+
+			while (column < screen->width && current[column] == next[column]) {
+				column++;
+			}
+			if (column >= screen->width) {
+				break;
+			}
+			/* merge runs separated by short gaps, escape sequence is longer */
+			start = column;
+			end = column;
+			for (gap = 0; column < screen->width && gap < 8; column++) {
+				if (current[column] != next[column]) {
+					end = column + 1;
+					gap = 0;
+				} else {
+					gap++;
+				}
+			}
+			column = end;
+			/* back up to the beginning of a multibyte sequence */
+			while (start > 0 && (next[start] & 0xc0) == 0x80) {
+				start--;
+			}
+			while (end < screen->width && (next[end] & 0xc0) == 0x80) {
+				end++;
+			}
+			for (cells = 1, j = 0; j < start; j++) {
+				if ((next[j] & 0xc0) != 0x80) {
+					cells++;
+				}
+			}
+			length += sprintf(&screen->out[length], "\x1b[%d;%dH",
+				row + 1, cells);
+			memcpy(&screen->out[length], &next[start], end - start);
+			length += end - start;
+			column = end;
+		}
+	}
+	if (length > 0) {
+		/* leave the cursor below the screen */
+		length += sprintf(&screen->out[length], "\x1b[%d;1H", screen->rows + 1);
+	}
+
+	while (written < length) {
+		ssize_t size = write(1, &screen->out[written], length - written);
+		if (size < 0 && errno != EINTR) {
+			break;
+		} else if (size > 0) {
+			written += size;
+		}
+	}
+
+	char * tmp = screen->current;
+	screen->current = screen->next;
+	screen->next = tmp;
+}
+
+static void terminal_begin(struct render_t * render, struct frame_t * frame) {
+	int i;
+
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		int length = strlen(column->name);
+		render->maxname = length > render->maxname ? length : render->maxname;
+	}
+
+	setlocale(LC_CTYPE, "");
+	iconv_t ic = iconv_open(nl_langinfo(CODESET), "ISO-8859-1");
+	if (ic != (iconv_t) -1) {
+		char in[3] = "\260C";
+		char * inptr = in;
+		char * outptr = render->degstr;
+		size_t insize = 3;
+		size_t outsize = sizeof(render->degstr);
+		iconv(ic, &inptr, &insize, &outptr, &outsize);
+		iconv_close(ic);
+	}
+
+	if (render->tty) {
+		render->screen = screen_init(render, frame);
+		if (!render->screen) {
+			fprintf(stderr, "No enough memory\n");
+		}
+		/* clear the screen */
+		printf("\x1b[H\x1b[J");
+		/* hide the cursor */
+		printf("\x1b[?25l");
+	}
+}
+
+static void terminal_frame(struct render_t * render, struct frame_t * frame) {
+	int i;
+
+	if (render->screen) {
+		/* escape sequences from stdio should precede the frame */
+		fflush(stdout);
+		screen_compose(render, frame);
+		screen_write(render->screen);
+		return;
+	} else if (render->tty) {
+		/* move the cursor */
+		printf("\x1b[H");
+	} else if (render->frames > 0) {
+		printf("\n");
+	}
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		if (i > 0 && column->unit !=
+			((struct frame_column_t *) array_get(frame->columns, i - 1))->unit) {
+			printf("\n");
+		}
+		if (!isnan(frame->values[i]) && column->unit == FRAME_UNIT_FLAGS) {
+			write_maxname(column->name, render->maxname);
+			write_flags(frame->values[i], ", ", "none");
+			/* names are not aligned, so clear the rest of the line */
+			printf(render->tty ? "\x1b[K\n" : "\n");
+		} else if (!isnan(frame->values[i])) {
+			write_maxname(column->name, render->maxname);
+			printf("%9.03f%s\n", frame->values[i],
+				unit_suffix(render, column->unit));
+		}
+	}
+}
+
+static void terminal_end(struct render_t * render) {
+	screen_free(render->screen);
+	render->screen = NULL;
+	if (render->tty) {
+		/* show the cursor */
+		printf("\x1b[?25h");
+	}
+}
+
+static void terminal_summary_row(struct render_t * render, const char * name,
+	struct stats_value_t * value, const char * suffix) {
+	write_maxname(name, render->maxname);
+	printf("%9.03f %9.03f %9.03f %9.03f %9.03f %9.03f %9.03f%s\n",
+		value->min, value->max, value->mean, value->stddev,
+		value->p50, value->p95, value->p99, suffix);
+}
+
+static void terminal_summary(struct render_t * render, struct frame_t * frame,
+	struct stats_t * stats) {
+	struct stats_value_t value;
+	int i;
+
+	if (!stats_get_skew(stats, &value)) {
+		return;
+	}
+	if (render->maxname < (int) strlen("Sampling")) {
+		render->maxname = strlen("Sampling");
+	}
+	printf("\n");
+	write_maxname("Summary", render->maxname);
+	printf("%9s %9s %9s %9s %9s %9s %9s\n",
+		"min", "max", "mean", "stddev", "p50", "p95", "p99");
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		/* averaging bit masks makes no sense */
+		if (column->unit != FRAME_UNIT_FLAGS && stats_get(stats, i, &value)) {
+			terminal_summary_row(render, column->name, &value,
+				unit_suffix(render, column->unit));
+		}
+	}
+	stats_get_skew(stats, &value);
+	terminal_summary_row(render, "Sampling", &value, " us");
+	printf("%ld samples\n", value.count);
+}
+
+static void csv_summary_row(const char * name, struct stats_value_t * value) {
+	printf("%s;%ld;%.03f;%.03f;%.03f;%.03f;%.03f;%.03f;%.03f\n", name,
+		value->count, value->min, value->max, value->mean, value->stddev,
+		value->p50, value->p95, value->p99);
+}
+
+static void csv_summary(UNUSED struct render_t * render, struct frame_t * frame,
+	struct stats_t * stats) {
+	struct stats_value_t value;
+	int i;
+
+	printf("\nname;count;min;max;mean;stddev;p50;p95;p99\n");
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		if (column->unit != FRAME_UNIT_FLAGS && stats_get(stats, i, &value)) {
+			csv_summary_row(column->name, &value);
+		}
+	}
+	if (stats_get_skew(stats, &value)) {
+		csv_summary_row("sampling_us", &value);
+	}
+}
+
+static void csv_header_begin(UNUSED struct render_t * render,
+	struct frame_t * frame) {
+	int i;
+
+	printf("time");
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		printf(";%s", column->name);
+	}
+	printf("\n");
+}
+
+static void csv_frame(UNUSED struct render_t * render, struct frame_t * frame) {
+	int i;
+
+	printf("%.03f", frame->time);
+	for (i = 0; i < frame->columns->count; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		if (isnan(frame->values[i])) {
+			printf(";");
+		} else if (column->unit == FRAME_UNIT_FLAGS) {
+			printf(";");
+			write_flags(frame->values[i], ",", "");
+		} else {
+			printf(";%.03f", frame->values[i]);
+		}
+	}
+	printf("\n");
+}
+
+static const struct render_ops_t render_ops[] = {
+	[RENDER_FORMAT_TERMINAL] = { terminal_begin, terminal_frame, terminal_end,
+		terminal_summary },
+	[RENDER_FORMAT_CSV] = { NULL, csv_frame, NULL, csv_summary },
+	[RENDER_FORMAT_CSV_HEADER] = { csv_header_begin, csv_frame, NULL,
+		csv_summary }
+};
+
+struct render_t * render_init(enum render_format format, struct frame_t * frame,
+	bool live) {
+	struct render_t * render = malloc(sizeof(struct render_t));
+	if (!render) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	render->ops = &render_ops[format];
+	render->tty = isatty(1);
+	render->live = live;
+	render->maxname = 0;
+	render->frames = 0;
+	render->screen = NULL;
+	strcpy(render->degstr, " C");
+	if (render->ops->begin) {
+		render->ops->begin(render, frame);
+	}
+	return render;
+}
+
+void render_frame(struct render_t * render, struct frame_t * frame) {
+	render->ops->frame(render, frame);
+	render->frames++;
+	if (render->live) {
+		fflush(stdout);
+	}
+}
+
+void render_summary(struct render_t * render, struct frame_t * frame,
+	struct stats_t * stats) {
+	if (render->ops->summary) {
+		render->ops->summary(render, frame, stats);
+	}
+	fflush(stdout);
+}
+
+void render_free(struct render_t * render) {
+	if (render) {
+		if (render->ops->end) {
+			render->ops->end(render);
+		}
+		fflush(stdout);
+		free(render);
+	}
+}
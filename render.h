@@ -0,0 +1,22 @@
+#ifndef __RENDER_H__
+#define __RENDER_H__
+
+#include "frame.h"
+#include "stats.h"
+
+enum render_format {
+	RENDER_FORMAT_TERMINAL,
+	RENDER_FORMAT_CSV,
+	RENDER_FORMAT_CSV_HEADER
+};
+
+struct render_t;
+
+struct render_t * render_init(enum render_format format, struct frame_t * frame,
+	bool live);
+void render_frame(struct render_t * render, struct frame_t * frame);
+void render_summary(struct render_t * render, struct frame_t * frame,
+	struct stats_t * stats);
+void render_free(struct render_t * render);
+
+#endif
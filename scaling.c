@@ -1,63 +1,511 @@
+#include "aperf.h"
 #include "config.h"
 #include "power.h"
+#include "pressure.h"
 #include "scaling.h"
 #include "stat.h"
 
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifndef IS_FREEBSD
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#endif
+
 #define DIR_CPUFREQ "/sys/devices/system/cpu/cpufreq"
 #define FILE_HINT "energy_performance_preference"
+#define FILE_AVAILABLE "energy_performance_available_preferences"
+#define FILE_RELATED "related_cpus"
+#define FILE_ONLINE "/sys/devices/system/cpu/online"
 #define BUFSZ 80
+#define BUFSZ_AVAILABLE 256
+#define BUFSZ_ONLINE 256
+#define BUFSZ_UEVENT 4096
+
+struct cpu_policy_hint_t {
+	int index;
+	int fd;
+	/* index into interned hints, -1 when unknown */
+	int hint;
+	bool switched;
+	struct timespec switched_time;
+	long switches;
+	long suppressed;
+	/* hint held back by the dwell time, -1 when none */
+	int suppressed_hint;
+};
 
 struct cpu_policy_full_t {
-	int cpu_count;
+	struct array_t * policies;
+	struct array_t * hints;
+	int uevent_fd;
+	int online_fd;
+	char online[BUFSZ_ONLINE];
+	bool validated;
+	struct timespec validated_time;
 	struct cpu_stat_t * cpu_stat;
-	struct rapl_t * rapl;
+	struct topology_t * topology;
+	struct aperf_t * aperf;
+	bool aperf_init;
+	struct pressure_t * pressure;
+	bool pressure_init;
 };
 
-struct cpu_policy_t * cpu_policy_init() {
-	int cpu_count = 0;
+static void hint_free(void * pointer) {
+	free(*(char **) pointer);
+}
+
+/* Returns the index of the hint, adding it to the list when it's new. */
+static int hint_intern(struct cpu_policy_full_t * full, const char * hint,
+	int length) {
+	char ** item;
+	char * copy;
+	int i;
+
+	for (i = 0; i < full->hints->count; i++) {
+		item = array_get(full->hints, i);
+		if (!strncmp(*item, hint, length) && !(*item)[length]) {
+			return i;
+		}
+	}
+	copy = malloc(length + 1);
+	if (!copy) {
+		perror("No enough memory");
+		return -1;
+	}
+	memcpy(copy, hint, length);
+	copy[length] = '\0';
+	item = array_add(full->hints);
+	if (!item) {
+		free(copy);
+		perror("No enough memory");
+		return -1;
+	}
+	*item = copy;
+	return full->hints->count - 1;
+}
+
+static void read_available_hints(struct cpu_policy_full_t * full, int policy) {
+	char path[PATH_MAX];
+	char buf[BUFSZ_AVAILABLE];
+	int size;
+	int fd;
+	int i;
+
+	snprintf(path, sizeof(path), "%s" DIR_CPUFREQ "/policy%d/" FILE_AVAILABLE,
+		get_root(), policy);
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		size = read(fd, buf, BUFSZ_AVAILABLE - 1);
+		close(fd);
+		buf[size > 0 ? size : 0] = '\0';
+		for (i = 0; i < size;) {
+			int length = strcspn(&buf[i], " \n");
+			if (length > 0) {
+				hint_intern(full, &buf[i], length);
+			}
+			i += length + 1;
+		}
+	}
+}
+
+static void policy_free(void * pointer) {
+	struct cpu_policy_hint_t * policy = pointer;
+	if (policy->fd >= 0) {
+		close(policy->fd);
+	}
+}
+
+static int read_string(const char * path, char * buf, int size) {
+	int fd = open(path, O_RDONLY);
+	int length = -1;
+	if (fd >= 0) {
+		length = read(fd, buf, size - 1);
+		close(fd);
+	}
+	buf[length > 0 ? length : 0] = '\0';
+	return length;
+}
+
+/* Parses the next range of a CPU list like "0-3,6,8-9". Returns NULL at the
+ * end of the list. */
+static const char * cpu_list_next(const char * p, int * first, int * last) {
+	char * tmp;
+
+	if (*p == ',') {
+		p++;
+	}
+	*first = (int) strtol(p, &tmp, 10);
+	if (tmp == p) {
+		return NULL;
+	}
+	*last = *first;
+	if (*tmp == '-') {
+		p = tmp + 1;
+		*last = (int) strtol(p, &tmp, 10);
+		if (tmp == p) {
+			return NULL;
+		}
+	}
+	return tmp;
+}
+
+static bool cpu_list_contains(const char * list, int cpu) {
+	int first;
+	int last;
+
+	while ((list = cpu_list_next(list, &first, &last))) {
+		if (cpu >= first && cpu <= last) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Policies of offline CPUs can not be changed, they are discovered again
+ * when the CPUs go online. */
+static bool policy_online(int index, const char * online) {
+	char path[PATH_MAX];
+	char buf[BUFSZ_ONLINE];
+	const char * p = buf;
+	int first;
+	int last;
+	int cpu;
+
+	snprintf(path, sizeof(path), "%s" DIR_CPUFREQ "/policy%d/" FILE_RELATED,
+		get_root(), index);
+	if (read_string(path, buf, sizeof(buf)) <= 0) {
+		return false;
+	}
+	while ((p = cpu_list_next(p, &first, &last))) {
+		for (cpu = first; cpu <= last; cpu++) {
+			if (cpu_list_contains(online, cpu)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void read_online(struct cpu_policy_full_t * full, char * buf) {
+	int size = full->online_fd >= 0
+		? pread(full->online_fd, buf, BUFSZ_ONLINE - 1, 0) : -1;
+	buf[size > 0 ? size : 0] = '\0';
+}
+
+static int policy_compare(const void * a, const void * b) {
+	return ((const struct cpu_policy_hint_t *) a)->index -
+		((const struct cpu_policy_hint_t *) b)->index;
+}
+
+/* Keeps the switch history of policies which existed before the rescan. */
+static void policy_restore(struct cpu_policy_full_t * full,
+	struct cpu_policy_hint_t * policy) {
+	int i;
+
+	policy->switched = false;
+	policy->switches = 0;
+	policy->suppressed = 0;
+	policy->suppressed_hint = -1;
+	for (i = 0; full->policies && i < full->policies->count; i++) {
+		struct cpu_policy_hint_t * old = array_get(full->policies, i);
+		if (old->index == policy->index) {
+			policy->switched = old->switched;
+			policy->switched_time = old->switched_time;
+			policy->switches = old->switches;
+			policy->suppressed = old->suppressed;
+			break;
+		}
+	}
+}
+
+/* Builds the list of existing policies, cached hints are read again on the
+ * next update. */
+static bool policies_scan(struct cpu_policy_full_t * full) {
+	char path[PATH_MAX];
+	struct array_t * policies;
 	DIR * dir;
 
-	dir = opendir(DIR_CPUFREQ);
+	policies = array_new(sizeof(struct cpu_policy_hint_t), policy_free);
+	if (!policies) {
+		fprintf(stderr, "No enough memory\n");
+		return false;
+	}
+
+	read_online(full, full->online);
+	snprintf(path, sizeof(path), "%s" DIR_CPUFREQ, get_root());
+	dir = opendir(path);
 	if (dir) {
 		struct dirent * entry;
 		while ((entry = readdir(dir))) {
 			if (strstr(entry->d_name, "policy") == entry->d_name) {
-				const char * index_str = &entry->d_name[6];
-				int index = atoi(index_str);
-				if (index >= 0) {
-					index++;
-					cpu_count = index > cpu_count ? index : cpu_count;
+				struct cpu_policy_hint_t * policy;
+				int index = atoi(&entry->d_name[6]);
+				if (index < 0 || (full->online[0] &&
+					!policy_online(index, full->online))) {
+					continue;
+				}
+				policy = array_add(policies);
+				if (!policy) {
+					closedir(dir);
+					array_free(policies);
+					fprintf(stderr, "No enough memory\n");
+					return false;
+				}
+				snprintf(path, sizeof(path), "%s" DIR_CPUFREQ "/policy%d/" FILE_HINT,
+					get_root(), index);
+				/* files are kept open, so unchanged hints cost no I/O */
+				policy->index = index;
+				policy->fd = open(path, O_RDWR);
+				policy->hint = -1;
+				policy_restore(full, policy);
+				if (policy->fd < 0) {
+					perror("Failed to open hint");
+				} else if (full->hints->count == 0) {
+					read_available_hints(full, index);
 				}
 			}
 		}
 		closedir(dir);
 	}
 
-	if (cpu_count > 0) {
-		struct cpu_policy_full_t * full = malloc(sizeof(struct cpu_policy_full_t));
-		if (!full) {
-			fprintf(stderr, "No enough memory");
-			return NULL;
+	if (policies->count > 1) {
+		qsort(array_get(policies, 0), policies->count,
+			sizeof(struct cpu_policy_hint_t), policy_compare);
+	}
+	if (full->policies) {
+		array_free(full->policies);
+	}
+	array_shrink(policies);
+	full->policies = policies;
+	full->validated = false;
+	return true;
+}
+
+#ifndef IS_FREEBSD
+static int uevent_open() {
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		NETLINK_KOBJECT_UEVENT);
+	if (fd >= 0) {
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		/* kernel events group */
+		addr.nl_groups = 1;
+		if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+			close(fd);
+			fd = -1;
 		}
-		full->cpu_count = cpu_count;
-		full->cpu_stat = cpu_stat_init();
-		full->rapl = rapl_init();
-		return (struct cpu_policy_t *) full;
-	} else {
+	}
+	return fd;
+}
+#endif
+
+/* Returns true when CPUs were plugged or unplugged since the last call.
+ * Uses kernel uevents when available, otherwise polls the online CPU list. */
+static bool hotplug_check(struct cpu_policy_full_t * full) {
+	bool changed = false;
+
+#ifndef IS_FREEBSD
+	if (full->uevent_fd >= 0) {
+		char buf[BUFSZ_UEVENT];
+		ssize_t size;
+
+		/* events start with "action@devpath" */
+		while ((size = recv(full->uevent_fd, buf, sizeof(buf) - 1,
+			MSG_DONTWAIT)) > 0) {
+			const char * devpath;
+			buf[size] = '\0';
+			devpath = strchr(buf, '@');
+			if (devpath && !strncmp(devpath + 1, "/devices/system/cpu/", 20)) {
+				changed = true;
+			}
+		}
+		if (size < 0 && errno == ENOBUFS) {
+			/* some events were lost */
+			changed = true;
+		}
+		return changed;
+	}
+#endif
+
+	if (full->online_fd >= 0) {
+		char buf[BUFSZ_ONLINE];
+		read_online(full, buf);
+		changed = strcmp(buf, full->online) != 0;
+	}
+	return changed;
+}
+
+void cpu_policy_free(struct cpu_policy_t * cpu_policy) {
+	if (cpu_policy) {
+		struct cpu_policy_full_t * full = (struct cpu_policy_full_t *) cpu_policy;
+		if (full->policies) {
+			array_free(full->policies);
+		}
+		if (full->hints) {
+			array_free(full->hints);
+		}
+		if (full->uevent_fd >= 0) {
+			close(full->uevent_fd);
+		}
+		if (full->online_fd >= 0) {
+			close(full->online_fd);
+		}
+		if (full->cpu_stat) {
+			cpu_stat_free(full->cpu_stat);
+		}
+		aperf_free(full->aperf);
+		topology_free(full->topology);
+		pressure_free(full->pressure);
+		free(full);
+	}
+}
+
+struct cpu_policy_t * cpu_policy_init() {
+	struct cpu_policy_full_t * full = malloc(sizeof(struct cpu_policy_full_t));
+	char path[PATH_MAX];
+
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
 		return NULL;
 	}
+	full->policies = NULL;
+	full->hints = array_new(sizeof(char *), hint_free);
+	full->validated = false;
+	full->cpu_stat = NULL;
+	full->topology = NULL;
+	full->aperf = NULL;
+	full->aperf_init = false;
+	full->pressure = NULL;
+	full->pressure_init = false;
+#ifndef IS_FREEBSD
+	full->uevent_fd = uevent_open();
+#else
+	full->uevent_fd = -1;
+#endif
+	snprintf(path, sizeof(path), "%s" FILE_ONLINE, get_root());
+	full->online_fd = open(path, O_RDONLY);
+
+	if (!full->hints || !policies_scan(full)) {
+		cpu_policy_free((struct cpu_policy_t *) full);
+		return NULL;
+	}
+	full->cpu_stat = cpu_stat_init();
+	return (struct cpu_policy_t *) full;
 }
 
-static bool check_cpu_stat(struct cpu_stat_t * cpu_stat, bool multi, float threshold) {
-	return cpu_stat && (multi ? cpu_stat->multi_core
-		: cpu_stat->single_core) >= threshold;
+static void read_hint(struct cpu_policy_full_t * full,
+	struct cpu_policy_hint_t * policy) {
+	char buf[BUFSZ];
+	int size = pread(policy->fd, buf, BUFSZ - 1, 0);
+	if (size >= 1) {
+		if (buf[size - 1] == '\n') {
+			size--;
+		}
+		policy->hint = hint_intern(full, buf, size);
+	} else {
+		perror("Failed to get hint");
+		policy->hint = -1;
+	}
+}
+
+static void write_hint(struct cpu_policy_full_t * full,
+	struct cpu_policy_hint_t * policy, int hint) {
+	char ** value = array_get(full->hints, hint);
+	if (pwrite(policy->fd, *value, strlen(*value), 0) < 0) {
+		perror("Failed to set hint");
+		/* the state is unknown, read all hints again on the next update */
+		policy->hint = -1;
+		full->validated = false;
+	} else {
+		policy->hint = hint;
+		policy->switched = true;
+		clock_gettime(CLOCK_MONOTONIC, &policy->switched_time);
+		policy->switches++;
+	}
+}
+
+static bool dwell_elapsed(struct cpu_policy_hint_t * policy, float dwell) {
+	struct timespec now;
+
+	if (!policy->switched || dwell <= 0) {
+		return true;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - policy->switched_time.tv_sec) +
+		(now.tv_nsec - policy->switched_time.tv_nsec) / 1000000000. >= dwell;
+}
+
+static bool revalidate_hints(struct cpu_policy_full_t * full,
+	int revalidate) {
+	struct timespec now;
+	int64_t elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (int64_t) (now.tv_sec - full->validated_time.tv_sec) * 1000 +
+		(now.tv_nsec - full->validated_time.tv_nsec) / 1000000;
+	if (!full->validated || elapsed >= revalidate) {
+		full->validated = true;
+		full->validated_time = now;
+		return true;
+	}
+	return false;
+}
+
+static bool check_cpu_stat(struct cpu_stat_t * cpu_stat, bool multi,
+	float threshold, float ewma) {
+	if (!cpu_stat) {
+		return false;
+	} else if (ewma > 0) {
+		struct cpu_stat_ewma_t * average = cpu_stat_ewma(cpu_stat, ewma);
+		return average && (multi ? average->multi_core
+			: average->single_core) >= threshold;
+	} else {
+		return (multi ? cpu_stat->multi_core
+			: cpu_stat->single_core) >= threshold;
+	}
+}
+
+static bool check_aperf(struct aperf_t * aperf, bool frequency, bool multi,
+	float threshold) {
+	if (!aperf) {
+		return false;
+	} else if (frequency) {
+		return (multi ? aperf->multi_core_frequency
+			: aperf->single_core_frequency) >= threshold;
+	} else {
+		return (multi ? aperf->multi_core_busy
+			: aperf->single_core_busy) >= threshold;
+	}
+}
+
+static bool check_pressure(struct pressure_t * pressure,
+	enum hwp_pressure_window window, float threshold) {
+	if (!pressure) {
+		return false;
+	}
+	switch (window) {
+		case HWP_PRESSURE_WINDOW_AVG10:
+			return pressure->avg10 >= threshold;
+		case HWP_PRESSURE_WINDOW_AVG60:
+			return pressure->avg60 >= threshold;
+		case HWP_PRESSURE_WINDOW_AVG300:
+			return pressure->avg300 >= threshold;
+		default:
+			return pressure->interval >= threshold;
+	}
 }
 
 static int rapl_lookup(struct rapl_t * rapl, const char * domain) {
@@ -88,7 +536,7 @@ static bool check_rapl(struct rapl_t * rapl, struct array_t * hwp_power_terms) {
 			if (device_index >= 0) {
 				struct rapl_device_t * rapl_device = array_get(rapl->devices,
 					device_index);
-				power = rapl_device->power;
+				power = isnan(rapl_device->power) ? 0 : rapl_device->power;
 			}
 			if (hwp_power_term->greater) {
 				current = power > hwp_power_term->power;
@@ -111,102 +559,118 @@ enum {
 	STATUS_LOAD
 };
 
-void cpu_policy_update(struct cpu_policy_t * cpu_policy, struct array_t * hwp_hints) {
-	if (cpu_policy) {
-		struct cpu_policy_full_t * full = (struct cpu_policy_full_t *) cpu_policy;
-		bool handled[full->cpu_count];
-		char * current_hints[full->cpu_count];
-		bool read_hints = false;
-		int cpu_stat_status = STATUS_UNKNOWN;
+static void update_hints(struct cpu_policy_full_t * full,
+	struct array_t * hwp_hints, struct rapl_t * rapl, int revalidate) {
+	if (full->policies->count > 0) {
+		bool handled[full->policies->count];
+		bool cpu_stat_measured = false;
 		int rapl_status = STATUS_UNKNOWN;
+		bool aperf_measured = false;
+		bool pressure_measured = false;
 		int i;
 
-		memset(handled, 0, full->cpu_count * sizeof(bool));
-		memset(current_hints, 0, full->cpu_count * sizeof(char *));
+		/* hints written by others are noticed after revalidation */
+		if (hwp_hints && hwp_hints->count > 0 &&
+			revalidate_hints(full, revalidate)) {
+			for (i = 0; i < full->policies->count; i++) {
+				struct cpu_policy_hint_t * policy = array_get(full->policies, i);
+				if (policy->fd >= 0) {
+					read_hint(full, policy);
+				}
+			}
+		}
+
+		for (i = 0; i < full->policies->count; i++) {
+			struct cpu_policy_hint_t * policy = array_get(full->policies, i);
+			handled[i] = policy->fd < 0;
+		}
+
+		for (i = 0; hwp_hints && i < hwp_hints->count; i++) {
+			struct hwp_hint_t * hwp_hint = array_get(hwp_hints, i);
+			if (hwp_hint->load && hwp_hint->load_ewma > 0 &&
+				!cpu_stat_measured) {
+				/* averages are updated on every interval */
+				cpu_stat_measured = true;
+				cpu_stat_measure(full->cpu_stat);
+			}
+		}
 
 		for (i = 0; hwp_hints && i < hwp_hints->count; i++) {
 			struct hwp_hint_t * hwp_hint = array_get(hwp_hints, i);
+			int normal_hint = hint_intern(full, hwp_hint->normal_hint,
+				strlen(hwp_hint->normal_hint));
+			int load_hint = hint_intern(full, hwp_hint->load_hint,
+				strlen(hwp_hint->load_hint));
 			int total_handled = 0;
-			const char * hint;
-			char buf[BUFSZ];
 			int j;
 
-			if (!hwp_hint->force && !read_hints) {
-				read_hints = true;
-				for (j = 0; j < full->cpu_count; j++) {
-					int fd;
-					sprintf(buf, DIR_CPUFREQ "/policy%d/" FILE_HINT, j);
-					fd = open(buf, O_RDONLY);
-					if (fd >= 0) {
-						int size = read(fd, buf, BUFSZ - 1);
-						if (size >= 1) {
-							if (buf[size - 1] == '\n') {
-								size--;
-							}
-						} else {
-							size = 0;
-						}
-						buf[size] = '\0';
-						current_hints[j] = malloc(size + 1);
-						if (current_hints[j] != NULL) {
-							memcpy(current_hints[j], buf, size + 1);
-						} else {
-							handled[j] = true;
-							perror("No enough memory");
-						}
-						close(fd);
-					} else {
-						handled[j] = true;
-						perror("Failed to get hint");
-					}
-				}
-			}
-
-			for (j = 0; j < full->cpu_count; j++) {
-				hint = NULL;
-				if (!handled[j] && (hwp_hint->force || (current_hints[j] &&
-					(!strcmp(current_hints[j], hwp_hint->normal_hint) ||
-						!strcmp(current_hints[j], hwp_hint->load_hint))))) {
+			for (j = 0; j < full->policies->count; j++) {
+				struct cpu_policy_hint_t * policy = array_get(full->policies, j);
+				int hint = -1;
+				if (!handled[j] && (hwp_hint->force || (policy->hint >= 0 &&
+					(policy->hint == normal_hint || policy->hint == load_hint)))) {
+					/* the load hint is kept until the exit threshold */
+					float threshold = policy->hint == load_hint
+						? hwp_hint->exit_threshold : hwp_hint->load_threshold;
 					bool load = false;
 					if (hwp_hint->load) {
-						if (cpu_stat_status == STATUS_UNKNOWN) {
-							if (full->cpu_stat) {
-								cpu_stat_measure(full->cpu_stat);
-							}
-							cpu_stat_status = check_cpu_stat(full->cpu_stat,
-								hwp_hint->load_multi, hwp_hint->load_threshold)
-								? STATUS_LOAD : STATUS_NORMAL;
+						if (!cpu_stat_measured) {
+							cpu_stat_measured = true;
+							cpu_stat_measure(full->cpu_stat);
 						}
-						load = cpu_stat_status == STATUS_LOAD;
+						load = check_cpu_stat(full->cpu_stat,
+							hwp_hint->load_multi, threshold, hwp_hint->load_ewma);
 					} else if (hwp_hint->power) {
 						if (rapl_status == STATUS_UNKNOWN) {
-							if (full->rapl) {
-								rapl_measure(full->rapl);
-							}
-							rapl_status = check_rapl(full->rapl,
+							rapl_status = check_rapl(rapl,
 								hwp_hint->hwp_power_terms)
 								? STATUS_LOAD : STATUS_NORMAL;
 						}
 						load = rapl_status == STATUS_LOAD;
+					} else if (hwp_hint->pressure) {
+						if (!full->pressure_init) {
+							full->pressure_init = true;
+							full->pressure = pressure_init(true);
+						}
+						if (!pressure_measured) {
+							pressure_measured = true;
+							pressure_measure(full->pressure);
+						}
+						load = check_pressure(full->pressure,
+							hwp_hint->pressure_window, threshold);
+					} else if (hwp_hint->busy || hwp_hint->frequency) {
+						if (!full->aperf_init) {
+							/* counters are sampled only when rules need them */
+							full->aperf_init = true;
+							full->topology = topology_init();
+							full->aperf = aperf_init(full->topology, NULL, true);
+						}
+						if (!aperf_measured) {
+							aperf_measured = true;
+							aperf_measure(full->aperf);
+						}
+						load = check_aperf(full->aperf, hwp_hint->frequency,
+							hwp_hint->load_multi, threshold);
 					}
-					hint = load ? hwp_hint->load_hint : hwp_hint->normal_hint;
+					hint = load ? load_hint : normal_hint;
 				}
 
-				if (hint && (hwp_hint->force || (current_hints[j] &&
-					strcmp(current_hints[j], hint)))) {
-					int fd;
-					sprintf(buf, DIR_CPUFREQ "/policy%d/" FILE_HINT, j);
-					fd = open(buf, O_WRONLY);
-					if (fd >= 0) {
-						if (write(fd, hint, strlen(hint)) < 0) {
-							perror("Failed to set hint");
+				if (hint >= 0 && (hwp_hint->force || policy->hint != hint)) {
+					if (policy->hint != hint && policy->hint >= 0 &&
+						!dwell_elapsed(policy, hwp_hint->dwell)) {
+						/* the current hint stays until the dwell time passes,
+						 * a switch is counted once while it's held back */
+						if (policy->suppressed_hint != hint) {
+							policy->suppressed_hint = hint;
+							policy->suppressed++;
 						}
-						close(fd);
-					} else {
-						perror("Failed to set hint");
+					} else if (policy->hint != hint) {
+						write_hint(full, policy, hint);
+						policy->suppressed_hint = -1;
 					}
-
 					handled[j] = true;
+				} else if (hint >= 0) {
+					policy->suppressed_hint = -1;
 				}
 
 				if (handled[j]) {
@@ -214,28 +678,35 @@ void cpu_policy_update(struct cpu_policy_t * cpu_policy, struct array_t * hwp_hi
 				}
 			}
 
-			if (total_handled == full->cpu_count) {
+			if (total_handled == full->policies->count) {
 				break;
 			}
 		}
+	}
+}
 
-		for (i = 0; i < full->cpu_count; i++) {
-			if (current_hints[i]) {
-				free(current_hints[i]);
-			}
+void cpu_policy_update(struct cpu_policy_t * cpu_policy, struct array_t * hwp_hints,
+	struct rapl_t * rapl, int revalidate) {
+	if (cpu_policy) {
+		struct cpu_policy_full_t * full = (struct cpu_policy_full_t *) cpu_policy;
+		if (hotplug_check(full)) {
+			policies_scan(full);
 		}
+		update_hints(full, hwp_hints, rapl, revalidate);
 	}
 }
 
-void cpu_policy_free(struct cpu_policy_t * cpu_policy) {
+void cpu_policy_print(struct cpu_policy_t * cpu_policy) {
 	if (cpu_policy) {
 		struct cpu_policy_full_t * full = (struct cpu_policy_full_t *) cpu_policy;
-		if (full->cpu_stat) {
-			cpu_stat_free(full->cpu_stat);
-		}
-		if (full->rapl) {
-			rapl_free(full->rapl);
+		int i;
+		for (i = 0; i < full->policies->count; i++) {
+			struct cpu_policy_hint_t * policy = array_get(full->policies, i);
+			char ** hint = policy->hint >= 0
+				? array_get(full->hints, policy->hint) : NULL;
+			printf("policy%d: %s, %ld switches, %ld suppressed\n", policy->index,
+				hint ? *hint : "unknown", policy->switches, policy->suppressed);
 		}
-		free(full);
+		fflush(stdout);
 	}
 }
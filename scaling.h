@@ -1,12 +1,15 @@
 #ifndef __SCALING_H__
 #define __SCALING_H__
 
+#include "power.h"
 #include "util.h"
 
 struct cpu_policy_t;
 
 struct cpu_policy_t * cpu_policy_init();
-void cpu_policy_update(struct cpu_policy_t * cpu_policy, struct array_t * hwp_hints);
+void cpu_policy_update(struct cpu_policy_t * cpu_policy, struct array_t * hwp_hints,
+	struct rapl_t * rapl, int revalidate);
+void cpu_policy_print(struct cpu_policy_t * cpu_policy);
 void cpu_policy_free(struct cpu_policy_t * cpu_policy);
 
 #endif
@@ -0,0 +1,420 @@
+#include "sensor.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef ENABLE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define BUFSZ 80
+
+struct sensor_t {
+	char * path;
+	int fd;
+	bool valid;
+	int64_t value;
+	char buf[BUFSZ];
+};
+
+#ifdef ENABLE_IO_URING
+
+struct uring_t {
+	int fd;
+	unsigned entries;
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	void * sq_map;
+	size_t sq_map_size;
+	void * cq_map;
+	size_t cq_map_size;
+	size_t sqes_size;
+};
+
+#endif
+
+struct sensors_full_t {
+	struct sensors_t parent;
+	struct array_t * items;
+	bool batch;
+#ifdef ENABLE_IO_URING
+	struct uring_t * uring;
+#endif
+};
+
+static void sensor_free(void * pointer) {
+	struct sensor_t * sensor = pointer;
+	if (sensor->fd >= 0) {
+		close(sensor->fd);
+	}
+	free(sensor->path);
+}
+
+struct sensors_t * sensors_init() {
+	struct sensors_full_t * full = malloc(sizeof(struct sensors_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->items = array_new(sizeof(struct sensor_t), sensor_free);
+	if (!full->items) {
+		free(full);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.count = 0;
+#ifdef ENABLE_IO_URING
+	full->batch = true;
+	full->uring = NULL;
+#else
+	full->batch = false;
+#endif
+	return &full->parent;
+}
+
+int sensors_add(struct sensors_t * sensors, const char * path) {
+	struct sensors_full_t * full = (struct sensors_full_t *) sensors;
+	struct sensor_t * sensor;
+	int length;
+	char * copy;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+
+	length = strlen(path);
+	copy = malloc(length + 1);
+	if (!copy) {
+		close(fd);
+		return -1;
+	}
+	memcpy(copy, path, length + 1);
+
+	sensor = array_add(full->items);
+	if (!sensor) {
+		free(copy);
+		close(fd);
+		return -1;
+	}
+	sensor->path = copy;
+	sensor->fd = fd;
+	sensor->valid = false;
+	sensor->value = 0;
+	full->parent.count = full->items->count;
+	return full->parent.count - 1;
+}
+
+static int sensor_pread(struct sensor_t * sensor) {
+	int size = -1;
+	if (sensor->fd >= 0) {
+		size = pread(sensor->fd, sensor->buf, BUFSZ - 1, 0);
+		if (size >= 0 || (errno != ENODEV && errno != ESTALE)) {
+			return size;
+		}
+		/* the attribute was removed and recreated, e.g. module reload */
+		close(sensor->fd);
+	}
+	sensor->fd = open(sensor->path, O_RDONLY);
+	if (sensor->fd >= 0) {
+		size = pread(sensor->fd, sensor->buf, BUFSZ - 1, 0);
+	}
+	return size;
+}
+
+static void sensor_parse(struct sensor_t * sensor, int size) {
+	if (size > 0) {
+		sensor->buf[size] = '\0';
+		sensor->value = (int64_t) strtoll(sensor->buf, NULL, 10);
+		sensor->valid = true;
+	} else {
+		sensor->valid = false;
+	}
+}
+
+#ifdef ENABLE_IO_URING
+
+static void uring_free(struct uring_t * uring) {
+	if (uring->sqes) {
+		munmap(uring->sqes, uring->sqes_size);
+	}
+	if (uring->cq_map) {
+		munmap(uring->cq_map, uring->cq_map_size);
+	}
+	if (uring->sq_map) {
+		munmap(uring->sq_map, uring->sq_map_size);
+	}
+	close(uring->fd);
+	free(uring);
+}
+
+static struct uring_t * uring_init(unsigned entries) {
+	struct io_uring_params params;
+	struct uring_t * uring;
+	void * map;
+	int fd;
+
+	memset(&params, 0, sizeof(struct io_uring_params));
+	fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		return NULL;
+	}
+	uring = calloc(1, sizeof(struct uring_t));
+	if (!uring) {
+		close(fd);
+		return NULL;
+	}
+	uring->fd = fd;
+	uring->entries = params.sq_entries;
+
+	uring->sq_map_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned);
+	map = mmap(NULL, uring->sq_map_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (map == MAP_FAILED) {
+		uring_free(uring);
+		return NULL;
+	}
+	uring->sq_map = map;
+	uring->sq_head = map + params.sq_off.head;
+	uring->sq_tail = map + params.sq_off.tail;
+	uring->sq_mask = map + params.sq_off.ring_mask;
+	uring->sq_array = map + params.sq_off.array;
+
+	uring->cq_map_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	map = mmap(NULL, uring->cq_map_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (map == MAP_FAILED) {
+		uring_free(uring);
+		return NULL;
+	}
+	uring->cq_map = map;
+	uring->cq_head = map + params.cq_off.head;
+	uring->cq_tail = map + params.cq_off.tail;
+	uring->cq_mask = map + params.cq_off.ring_mask;
+	uring->cqes = map + params.cq_off.cqes;
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	map = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (map == MAP_FAILED) {
+		uring_free(uring);
+		return NULL;
+	}
+	uring->sqes = map;
+	return uring;
+}
+
+/* Submits reads for items [from, to) and reaps all of them. Returns false
+ * when io_uring can not be used, so the caller should fall back to pread. */
+static bool uring_read(struct uring_t * uring, struct array_t * items,
+	int from, int to) {
+	unsigned tail = *uring->sq_tail;
+	unsigned submit = 0;
+	unsigned pending;
+	unsigned head;
+	int i;
+
+	for (i = from; i < to; i++) {
+		struct sensor_t * sensor = array_get(items, i);
+		if (sensor->fd >= 0) {
+			unsigned index = tail & *uring->sq_mask;
+			struct io_uring_sqe * sqe = &uring->sqes[index];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = sensor->fd;
+			sqe->addr = (uintptr_t) sensor->buf;
+			sqe->len = BUFSZ - 1;
+			sqe->off = 0;
+			sqe->user_data = i;
+			uring->sq_array[index] = index;
+			tail++;
+			submit++;
+		} else {
+			sensor_parse(sensor, sensor_pread(sensor));
+		}
+	}
+	if (submit == 0) {
+		return true;
+	}
+	__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+	/* submit counts outstanding completions, pending counts reads the
+	 * kernel has not consumed yet, e.g. after a signal interrupted it */
+	pending = submit;
+	head = *uring->cq_head;
+	while (submit > 0) {
+		struct io_uring_cqe * cqe;
+		struct sensor_t * sensor;
+		if (pending > 0 ||
+			head == __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+			long consumed;
+			__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+			consumed = syscall(__NR_io_uring_enter, uring->fd, pending, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+			if (consumed < 0 && errno != EINTR) {
+				return false;
+			} else if (consumed > 0) {
+				pending -= consumed < (long) pending ? consumed : pending;
+			}
+			continue;
+		}
+		cqe = &uring->cqes[head & *uring->cq_mask];
+		sensor = array_get(items, (int) cqe->user_data);
+		if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+			/* IORING_OP_READ is not supported by the kernel */
+			__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+			return false;
+		} else if (cqe->res == -ENODEV || cqe->res == -ESTALE) {
+			sensor_parse(sensor, sensor_pread(sensor));
+		} else {
+			sensor_parse(sensor, cqe->res);
+		}
+		head++;
+		submit--;
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+	return submit == 0;
+}
+
+static bool sensors_read_batch(struct sensors_full_t * full) {
+	int i;
+
+	if (!full->uring) {
+		unsigned entries = 1;
+		while (entries < (unsigned) full->items->count && entries < 4096) {
+			entries <<= 1;
+		}
+		full->uring = uring_init(entries);
+		if (!full->uring) {
+			return false;
+		}
+	}
+	for (i = 0; i < full->items->count; i += full->uring->entries) {
+		int to = i + full->uring->entries;
+		if (!uring_read(full->uring, full->items, i,
+			to < full->items->count ? to : full->items->count)) {
+			uring_free(full->uring);
+			full->uring = NULL;
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
+
+bool sensors_set_batch(struct sensors_t * sensors, bool batch) {
+	struct sensors_full_t * full = (struct sensors_full_t *) sensors;
+#ifdef ENABLE_IO_URING
+	if (!batch && full->uring) {
+		uring_free(full->uring);
+		full->uring = NULL;
+	}
+	full->batch = batch;
+#else
+	full->batch = false;
+#endif
+	return full->batch == batch;
+}
+
+void sensors_read(struct sensors_t * sensors) {
+	if (sensors) {
+		struct sensors_full_t * full = (struct sensors_full_t *) sensors;
+		int i;
+
+#ifdef ENABLE_IO_URING
+		if (full->batch) {
+			if (sensors_read_batch(full)) {
+				return;
+			}
+			full->batch = false;
+		}
+#endif
+		for (i = 0; i < full->items->count; i++) {
+			struct sensor_t * sensor = array_get(full->items, i);
+			sensor_parse(sensor, sensor_pread(sensor));
+		}
+	}
+}
+
+bool sensors_find_hwmon(const char * name, char * out, int index) {
+	char path[PATH_MAX];
+	char buf[BUFSZ];
+	DIR * dir;
+
+	snprintf(path, sizeof(path), "%s" DIR_HWMON, get_root());
+	dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "Failed to open hwmon directory\n");
+		return false;
+	}
+	struct dirent * dirent;
+	while ((dirent = readdir(dir))) {
+		if (strlen(dirent->d_name) <= 30) {
+			snprintf(path, sizeof(path), "%s" DIR_HWMON "/%s/name",
+				get_root(), dirent->d_name);
+			int fd = open(path, O_RDONLY);
+			if (fd >= 0) {
+				int size = read(fd, buf, BUFSZ - 1);
+				if (size > 1) {
+					int nlen = buf[size - 1] == '\n' ? size - 2 : size - 1;
+					buf[nlen + 1] = '\0';
+					/* every package has its own hwmon instance */
+					if (!strcmp(buf, name) && index-- == 0) {
+						strcpy(out, dirent->d_name);
+						close(fd);
+						closedir(dir);
+						return true;
+					}
+				}
+				close(fd);
+			}
+		}
+	}
+	closedir(dir);
+
+	return false;
+}
+
+bool sensors_value(struct sensors_t * sensors, int index, int64_t * value) {
+	struct sensors_full_t * full = (struct sensors_full_t *) sensors;
+	if (sensors && index >= 0 && index < full->items->count) {
+		struct sensor_t * sensor = array_get(full->items, index);
+		if (sensor->valid) {
+			*value = sensor->value;
+			return true;
+		}
+	}
+	return false;
+}
+
+void sensors_free(struct sensors_t * sensors) {
+	if (sensors) {
+		struct sensors_full_t * full = (struct sensors_full_t *) sensors;
+#ifdef ENABLE_IO_URING
+		if (full->uring) {
+			uring_free(full->uring);
+		}
+#endif
+		array_free(full->items);
+		free(full);
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef __SENSOR_H__
+#define __SENSOR_H__
+
+#include "util.h"
+
+#define DIR_HWMON "/sys/class/hwmon"
+#define DIR_CPU_DEVICES "/sys/bus/cpu/devices"
+
+struct sensors_t {
+	int count;
+};
+
+struct sensors_t * sensors_init();
+int sensors_add(struct sensors_t * sensors, const char * path);
+bool sensors_set_batch(struct sensors_t * sensors, bool batch);
+void sensors_read(struct sensors_t * sensors);
+bool sensors_find_hwmon(const char * name, char * out, int index);
+bool sensors_value(struct sensors_t * sensors, int index, int64_t * value);
+void sensors_free(struct sensors_t * sensors);
+
+#endif
@@ -1,64 +1,225 @@
 #include "stat.h"
+#include "util.h"
 
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_STAT "/proc/stat"
+#define BUFSZ 4096
 
 struct cpu_stat_value_t {
 	long int idle;
 	long int total;
 };
 
+struct cpu_stat_ewma_full_t {
+	struct cpu_stat_ewma_t parent;
+	bool started;
+};
+
 struct cpu_stat_full_t {
 	struct cpu_stat_t parent;
-	int cpu_count;
 	struct cpu_stat_value_t * values;
+	struct array_t * ewmas;
+	int fd;
+	char * buf;
+	size_t size;
+	bool valid;
+	struct timespec time;
 };
 
-static void read_eol(FILE * file) {
-	int c;
-	while ((c = fgetc(file)) != EOF && c != '\n');
+/* Reads the whole file into the reusable buffer, which grows until the file
+ * fits. Returns false when the file can not be read. */
+static bool stat_read(struct cpu_stat_full_t * full) {
+	while (true) {
+		ssize_t length = pread(full->fd, full->buf, full->size - 1, 0);
+		char * buf;
+		if (length < 0) {
+			return false;
+		} else if ((size_t) length < full->size - 1) {
+			full->buf[length] = '\0';
+			return true;
+		}
+		buf = realloc(full->buf, 2 * full->size);
+		if (!buf) {
+			return false;
+		}
+		full->buf = buf;
+		full->size *= 2;
+	}
+}
+
+static const char * scan_number(const char * p, long int * value) {
+	long int result = 0;
+
+	while (*p == ' ') {
+		p++;
+	}
+	if ((unsigned char) (*p - '0') > 9) {
+		return NULL;
+	}
+	do {
+		result = 10 * result + (*p++ - '0');
+	} while ((unsigned char) (*p - '0') <= 9);
+	*value = result;
+	return p;
+}
+
+static void stat_parse_cpu(struct cpu_stat_full_t * full, const char * p,
+	int * cpu_count, float * single_core, float * multi_core) {
+	const char * next;
+	long int index;
+	long int value;
+	long int idle = 0;
+	long int total = 0;
+	int count = 0;
+
+	p = scan_number(p, &index);
+	while ((next = scan_number(p, &value))) {
+		p = next;
+		count++;
+		total += value;
+		if (count == 4) {
+			idle = value;
+		}
+	}
+
+	if (cpu_count) {
+		*cpu_count = index + 1 > *cpu_count ? index + 1 : *cpu_count;
+	} else if (index < full->parent.cpu_count && count >= 4) {
+		struct cpu_stat_value_t * last = &full->values[index];
+		if (last->idle > 0 && last->total > 0 && total > last->total) {
+			double load = (double) (total - last->total -
+				idle + last->idle) / (total - last->total);
+			*single_core = load > *single_core ? load : *single_core;
+			*multi_core += load;
+			full->parent.loads[index] = load;
+			full->valid = true;
+		}
+		last->idle = idle;
+		last->total = total;
+	}
+}
+
+/* Parses cpu lines at the beginning of the file and stops at the first line
+ * of another kind. Counts CPUs when cpu_count is not NULL, otherwise updates
+ * the load. */
+static void stat_parse(struct cpu_stat_full_t * full, int * cpu_count) {
+	const char * p = full->buf;
+	float single_core = 0;
+	float multi_core = 0;
+
+	while (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+		/* the first line is the sum of all CPUs */
+		if ((unsigned char) (p[3] - '0') <= 9) {
+			stat_parse_cpu(full, &p[3], cpu_count, &single_core, &multi_core);
+		}
+		p = strchr(p, '\n');
+		if (!p) {
+			break;
+		}
+		p++;
+	}
+
+	full->parent.single_core = single_core;
+	full->parent.multi_core = multi_core;
+}
+
+static void ewma_update(struct cpu_stat_full_t * full,
+	struct cpu_stat_ewma_full_t * ewma, double interval) {
+	float alpha = ewma->started ? 1 - exp(-interval / ewma->parent.tau) : 1;
+	float single_core = 0;
+	float multi_core = 0;
+	int i;
+
+	for (i = 0; i < full->parent.cpu_count; i++) {
+		float * load = &ewma->parent.loads[i];
+		*load += alpha * (full->parent.loads[i] - *load);
+		single_core = *load > single_core ? *load : single_core;
+		multi_core += *load;
+	}
+	ewma->parent.single_core = single_core;
+	ewma->parent.multi_core = multi_core;
+	ewma->started = true;
+}
+
+static void ewma_free(void * pointer) {
+	struct cpu_stat_ewma_full_t * ewma =
+		*(struct cpu_stat_ewma_full_t **) pointer;
+	free(ewma->parent.loads);
+	free(ewma);
+}
+
+void cpu_stat_free(struct cpu_stat_t * cpu_stat) {
+	if (cpu_stat) {
+		struct cpu_stat_full_t * full = (struct cpu_stat_full_t *) cpu_stat;
+		if (full->fd >= 0) {
+			close(full->fd);
+		}
+		if (full->ewmas) {
+			array_free(full->ewmas);
+		}
+		free(full->parent.loads);
+		free(full->values);
+		free(full->buf);
+		free(full);
+	}
 }
 
 struct cpu_stat_t * cpu_stat_init() {
-	FILE * file;
-	char buf[80];
+	struct cpu_stat_full_t * full;
+	char path[PATH_MAX];
 	int cpu_count = 0;
-	int index;
-
-	file = fopen("/proc/stat", "r");
-	if (file) {
-		while (fscanf(file, "%s", buf) == 1 && strstr(buf, "cpu") == buf) {
-			read_eol(file);
-			if (strlen(buf) > 3) {
-				index = atoi(&buf[3]) + 1;
-				cpu_count = cpu_count >= index ? cpu_count : index;
-			}
+
+	full = malloc(sizeof(struct cpu_stat_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.single_core = 0;
+	full->parent.multi_core = 0;
+	full->parent.cpu_count = 0;
+	full->parent.loads = NULL;
+	full->values = NULL;
+	full->ewmas = array_new(sizeof(struct cpu_stat_ewma_full_t *), ewma_free);
+	full->valid = false;
+	clock_gettime(CLOCK_MONOTONIC, &full->time);
+	full->size = BUFSZ;
+	full->buf = malloc(full->size);
+	if (!full->buf || !full->ewmas) {
+		if (full->ewmas) {
+			array_free(full->ewmas);
 		}
-		fclose(file);
+		free(full->buf);
+		free(full);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+
+	snprintf(path, sizeof(path), "%s" FILE_STAT, get_root());
+	full->fd = open(path, O_RDONLY);
+	if (full->fd >= 0 && stat_read(full)) {
+		stat_parse(full, &cpu_count);
 	}
 
 	if (cpu_count > 0) {
-		struct cpu_stat_full_t * full = malloc(sizeof(struct cpu_stat_full_t));
-		struct cpu_stat_value_t * values = malloc(cpu_count *
-			sizeof(struct cpu_stat_value_t));
-		if (!full || !values) {
-			if (full) {
-				free(full);
-			}
-			if (values) {
-				free(values);
-			}
+		full->values = calloc(cpu_count, sizeof(struct cpu_stat_value_t));
+		full->parent.loads = calloc(cpu_count, sizeof(float));
+		if (!full->values || !full->parent.loads) {
+			cpu_stat_free(&full->parent);
 			fprintf(stderr, "No enough memory\n");
 			return NULL;
 		}
-		memset(values, 0, cpu_count * sizeof(struct cpu_stat_value_t));
-		full->parent.single_core = 0;
-		full->parent.multi_core = 0;
-		full->cpu_count = cpu_count;
-		full->values = values;
+		full->parent.cpu_count = cpu_count;
 		return &full->parent;
 	} else {
+		cpu_stat_free(&full->parent);
 		fprintf(stderr, "Failed to read /proc/stat\n");
 		return NULL;
 	}
@@ -67,66 +228,65 @@ struct cpu_stat_t * cpu_stat_init() {
 void cpu_stat_measure(struct cpu_stat_t * cpu_stat) {
 	if (cpu_stat) {
 		struct cpu_stat_full_t * full = (struct cpu_stat_full_t *) cpu_stat;
-		int index;
-		int count;
-		long int idle;
-		long int total;
-		long int value;
-		float single_core = 0;
-		float multi_core = 0;
-		double load;
-		FILE * file;
-		char buf[80];
-
-		file = fopen("/proc/stat", "r");
-		if (file) {
-			while (fscanf(file, "%s", buf) == 1 && strstr(buf, "cpu") == buf) {
-				if (strlen(buf) > 3) {
-					index = atoi(&buf[3]);
-					if (index >= 0 && index < full->cpu_count) {
-						count = 0;
-						idle = 0;
-						total = 0;
-						while (fscanf(file, "%ld", &value) == 1) {
-							count++;
-							total += value;
-							if (count == 4) {
-								idle = value;
-							}
-						}
-
-						if (count >= 4) {
-							if (full->values[index].idle > 0 &&
-								full->values[index].total > 0) {
-								load = (double) (total -
-									full->values[index].total -
-									idle + full->values[index].idle) /
-									(total - full->values[index].total);
-								single_core = load > single_core
-									? load : single_core;
-								multi_core = multi_core > 0
-									? multi_core + load : load;
-							}
-							full->values[index].idle = idle;
-							full->values[index].total = total;
-						}
-					}
-				} else {
-					read_eol(file);
-				}
-			}
-			fclose(file);
+		struct timespec now;
+		double interval;
+		int i;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		interval = (now.tv_sec - full->time.tv_sec) +
+			(now.tv_nsec - full->time.tv_nsec) / 1000000000.;
+		full->time = now;
+
+		/* offline CPUs disappear from the file */
+		memset(full->parent.loads, 0, full->parent.cpu_count * sizeof(float));
+		if (stat_read(full)) {
+			stat_parse(full, NULL);
+		} else {
+			full->parent.single_core = 0;
+			full->parent.multi_core = 0;
 		}
 
-		full->parent.single_core = single_core;
-		full->parent.multi_core = multi_core;
+		for (i = 0; full->valid && i < full->ewmas->count; i++) {
+			struct cpu_stat_ewma_full_t ** ewma = array_get(full->ewmas, i);
+			ewma_update(full, *ewma, interval);
+		}
 	}
 }
 
-void cpu_stat_free(struct cpu_stat_t * cpu_stat) {
-	if (cpu_stat) {
-		struct cpu_stat_full_t * full = (struct cpu_stat_full_t *) cpu_stat;
-		free(full->values);
-		free(full);
+struct cpu_stat_ewma_t * cpu_stat_ewma(struct cpu_stat_t * cpu_stat,
+	float tau) {
+	struct cpu_stat_full_t * full = (struct cpu_stat_full_t *) cpu_stat;
+	struct cpu_stat_ewma_full_t ** item;
+	struct cpu_stat_ewma_full_t * ewma;
+	int i;
+
+	for (i = 0; i < full->ewmas->count; i++) {
+		item = array_get(full->ewmas, i);
+		if ((*item)->parent.tau == tau) {
+			return &(*item)->parent;
+		}
+	}
+
+	ewma = malloc(sizeof(struct cpu_stat_ewma_full_t));
+	if (!ewma) {
+		return NULL;
+	}
+	ewma->parent.tau = tau;
+	ewma->parent.loads = calloc(cpu_stat->cpu_count, sizeof(float));
+	ewma->started = false;
+	item = ewma->parent.loads ? array_add(full->ewmas) : NULL;
+	if (!item) {
+		free(ewma->parent.loads);
+		free(ewma);
+		return NULL;
+	}
+	*item = ewma;
+	/* start from the last interval, later intervals are averaged in */
+	if (full->valid) {
+		ewma_update(full, ewma, 0);
+	} else {
+		ewma->parent.single_core = 0;
+		ewma->parent.multi_core = 0;
 	}
+	return &ewma->parent;
 }
@@ -4,10 +4,23 @@
 struct cpu_stat_t {
 	float single_core;
 	float multi_core;
+	int cpu_count;
+	/* load of every CPU over the last interval */
+	float * loads;
+};
+
+struct cpu_stat_ewma_t {
+	/* time constant in seconds */
+	float tau;
+	float single_core;
+	float multi_core;
+	float * loads;
 };
 
 struct cpu_stat_t * cpu_stat_init();
 void cpu_stat_measure(struct cpu_stat_t * cpu_stat);
+struct cpu_stat_ewma_t * cpu_stat_ewma(struct cpu_stat_t * cpu_stat,
+	float tau);
 void cpu_stat_free(struct cpu_stat_t * cpu_stat);
 
 #endif
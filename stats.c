@@ -0,0 +1,152 @@
+#include "stats.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Log-linear histogram: bucket 0 holds values below STATS_MIN, the other
+ * buckets grow by STATS_GROWTH each, which bounds percentile error to 1%. */
+#define STATS_MIN 1e-3
+#define STATS_GROWTH 1.02
+#define STATS_BUCKETS 1048
+
+struct stats_column_t {
+	long count;
+	double mean;
+	double m2;
+	float min;
+	float max;
+	uint32_t * buckets;
+};
+
+struct stats_t {
+	int count;
+	struct stats_column_t * columns;
+	uint32_t * buckets;
+};
+
+static int stats_bucket(float value) {
+	int index;
+	if (!(value >= STATS_MIN)) {
+		return 0;
+	}
+	index = 1 + (int) (log(value / STATS_MIN) / log(STATS_GROWTH));
+	return index < STATS_BUCKETS ? index : STATS_BUCKETS - 1;
+}
+
+static float stats_bucket_value(int index) {
+	if (index == 0) {
+		return 0;
+	}
+	/* geometric middle of the bucket */
+	return STATS_MIN * pow(STATS_GROWTH, index - 0.5);
+}
+
+struct stats_t * stats_init(struct frame_t * frame) {
+	/* one extra column accumulates the sampling skew */
+	int count = frame->columns->count + 1;
+	struct stats_t * stats = malloc(sizeof(struct stats_t));
+	struct stats_column_t * columns = calloc(count,
+		sizeof(struct stats_column_t));
+	uint32_t * buckets = calloc((size_t) count * STATS_BUCKETS,
+		sizeof(uint32_t));
+	int i;
+
+	if (!stats || !columns || !buckets) {
+		free(stats);
+		free(columns);
+		free(buckets);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		columns[i].buckets = &buckets[(size_t) i * STATS_BUCKETS];
+	}
+	stats->count = count;
+	stats->columns = columns;
+	stats->buckets = buckets;
+	return stats;
+}
+
+static void stats_column_add(struct stats_column_t * column, float value) {
+	double delta;
+	if (isnan(value)) {
+		return;
+	}
+	if (column->count == 0 || value < column->min) {
+		column->min = value;
+	}
+	if (column->count == 0 || value > column->max) {
+		column->max = value;
+	}
+	column->count++;
+	delta = value - column->mean;
+	column->mean += delta / column->count;
+	column->m2 += delta * (value - column->mean);
+	column->buckets[stats_bucket(value)]++;
+}
+
+void stats_add(struct stats_t * stats, struct frame_t * frame) {
+	int i;
+	for (i = 0; i < stats->count - 1; i++) {
+		struct frame_column_t * column = array_get(frame->columns, i);
+		/* cumulative energy and bit masks have no meaningful distribution */
+		if (column->unit != FRAME_UNIT_ENERGY &&
+			column->unit != FRAME_UNIT_FLAGS) {
+			stats_column_add(&stats->columns[i], frame->values[i]);
+		}
+	}
+	/* microseconds fit the histogram range better than seconds */
+	stats_column_add(&stats->columns[stats->count - 1],
+		frame->skew * 1000000.f);
+}
+
+static float stats_percentile(struct stats_column_t * column, double rank) {
+	long target = (long) ceil(rank * column->count);
+	long total = 0;
+	int i;
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		total += column->buckets[i];
+		if (total >= target && total > 0) {
+			float value = stats_bucket_value(i);
+			return value < column->min ? column->min
+				: value > column->max ? column->max : value;
+		}
+	}
+	return column->max;
+}
+
+static bool stats_column_get(struct stats_column_t * column,
+	struct stats_value_t * value) {
+	if (column->count == 0) {
+		return false;
+	}
+	value->count = column->count;
+	value->min = column->min;
+	value->max = column->max;
+	value->mean = column->mean;
+	value->stddev = column->count > 1
+		? sqrt(column->m2 / (column->count - 1)) : 0;
+	value->p50 = stats_percentile(column, 0.50);
+	value->p95 = stats_percentile(column, 0.95);
+	value->p99 = stats_percentile(column, 0.99);
+	return true;
+}
+
+bool stats_get(struct stats_t * stats, int column, struct stats_value_t * value) {
+	return column >= 0 && column < stats->count - 1 &&
+		stats_column_get(&stats->columns[column], value);
+}
+
+bool stats_get_skew(struct stats_t * stats, struct stats_value_t * value) {
+	return stats_column_get(&stats->columns[stats->count - 1], value);
+}
+
+void stats_free(struct stats_t * stats) {
+	if (stats) {
+		free(stats->buckets);
+		free(stats->columns);
+		free(stats);
+	}
+}
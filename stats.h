@@ -0,0 +1,26 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include "frame.h"
+
+struct stats_value_t {
+	long count;
+	float min;
+	float max;
+	double mean;
+	double stddev;
+	float p50;
+	float p95;
+	float p99;
+};
+
+struct stats_t;
+
+struct stats_t * stats_init(struct frame_t * frame);
+void stats_add(struct stats_t * stats, struct frame_t * frame);
+bool stats_get(struct stats_t * stats, int column, struct stats_value_t * value);
+/* skew is reported in microseconds */
+bool stats_get_skew(struct stats_t * stats, struct stats_value_t * value);
+void stats_free(struct stats_t * stats);
+
+#endif
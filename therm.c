@@ -0,0 +1,167 @@
+#include "msr.h"
+#include "therm.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct therm_sensor_ext_t {
+	int fd_msr;
+	int msr_addr;
+	int tjmax;
+};
+
+struct therm_full_t {
+	struct therm_t parent;
+	struct array_t * exts;
+};
+
+static void therm_sensor_free(void * pointer) {
+	struct therm_sensor_t * sensor = pointer;
+	free(sensor->name);
+}
+
+void therm_free(struct therm_t * therm) {
+	if (therm) {
+		struct therm_full_t * full = (struct therm_full_t *) therm;
+		if (full->parent.sensors) {
+			array_free(full->parent.sensors);
+		}
+		if (full->exts) {
+			array_free(full->exts);
+		}
+		free(full);
+	}
+}
+
+static bool therm_add(struct therm_full_t * full, const char * name, int fd,
+	int msr_addr, int tjmax) {
+	struct therm_sensor_t * sensor;
+	struct therm_sensor_ext_t * ext;
+	int length = strlen(name);
+	char * copy = malloc(length + 1);
+
+	if (!copy) {
+		return false;
+	}
+	memcpy(copy, name, length + 1);
+	sensor = array_add(full->parent.sensors);
+	if (!sensor) {
+		free(copy);
+		return false;
+	}
+	sensor->name = copy;
+	sensor->temperature = NAN;
+
+	ext = array_add(full->exts);
+	if (!ext) {
+		full->parent.sensors->count--;
+		free(copy);
+		return false;
+	}
+	ext->fd_msr = fd;
+	ext->msr_addr = msr_addr;
+	ext->tjmax = tjmax;
+	return true;
+}
+
+struct therm_t * therm_init(struct topology_t * topology,
+	struct filter_t * filter) {
+	struct therm_full_t * full;
+	bool discovered = false;
+	char buf[40];
+	int i, j;
+
+	full = malloc(sizeof(struct therm_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.sensors = array_new(sizeof(struct therm_sensor_t),
+		therm_sensor_free);
+	full->exts = array_new(sizeof(struct therm_sensor_ext_t), NULL);
+	if (!full->parent.sensors || !full->exts) {
+		therm_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+
+	for (i = 0; topology && i < topology->cpus->count; i++) {
+		struct topology_cpu_t * package = array_get(topology->cpus, i);
+		uint64_t value;
+		int tjmax;
+		int fd;
+
+		if (!package->first_in_package) {
+			continue;
+		}
+		fd = topology_msr(package);
+		if (fd < 0 || !msr_rd(fd, MSR_ADDR_TEMPERATURE, value)) {
+			continue;
+		}
+		tjmax = (value >> 16) & 0xff;
+
+		/* same labels as coretemp driver uses */
+		sprintf(buf, "Package id %d", package->package);
+		discovered = true;
+		if (msr_rd(fd, MSR_ADDR_PACKAGE_THERM_STATUS, value) &&
+			filter_match(filter, buf) &&
+			!therm_add(full, buf, fd, MSR_ADDR_PACKAGE_THERM_STATUS, tjmax)) {
+			therm_free(&full->parent);
+			fprintf(stderr, "No enough memory\n");
+			return NULL;
+		}
+		for (j = 0; j < topology->cpus->count; j++) {
+			struct topology_cpu_t * cpu = array_get(topology->cpus, j);
+			if (cpu->package != package->package || !cpu->first_in_core) {
+				continue;
+			}
+			topology_core_name(topology, cpu, buf);
+			if (!filter_match(filter, buf)) {
+				continue;
+			}
+			fd = topology_msr(cpu);
+			if (fd < 0 || !msr_rd(fd, MSR_ADDR_THERM_STATUS, value)) {
+				continue;
+			}
+			if (!therm_add(full, buf, fd, MSR_ADDR_THERM_STATUS, tjmax)) {
+				therm_free(&full->parent);
+				fprintf(stderr, "No enough memory\n");
+				return NULL;
+			}
+		}
+	}
+
+	if (full->parent.sensors->count == 0) {
+		therm_free(&full->parent);
+		if (!discovered) {
+			fprintf(stderr, "Failed to read thermal status MSR\n");
+		}
+		return NULL;
+	}
+	array_shrink(full->parent.sensors);
+	array_shrink(full->exts);
+	return &full->parent;
+}
+
+void therm_measure(struct therm_t * therm) {
+	if (therm) {
+		struct therm_full_t * full = (struct therm_full_t *) therm;
+		int i;
+
+		for (i = 0; i < full->parent.sensors->count; i++) {
+			struct therm_sensor_t * sensor = array_get(full->parent.sensors, i);
+			struct therm_sensor_ext_t * ext = array_get(full->exts, i);
+			uint64_t value;
+			/* bit 31 marks the digital readout as valid */
+			if (msr_rd(ext->fd_msr, ext->msr_addr, value) &&
+				((value >> 31) & 0x1)) {
+				sensor->temperature = ext->tjmax - ((value >> 16) & 0x7f);
+			} else {
+				sensor->temperature = NAN;
+			}
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef __THERM_H__
+#define __THERM_H__
+
+#include "filter.h"
+#include "topology.h"
+#include "util.h"
+
+struct therm_sensor_t {
+	char * name;
+	float temperature;
+};
+
+struct therm_t {
+	struct array_t * sensors;
+};
+
+struct therm_t * therm_init(struct topology_t * topology,
+	struct filter_t * filter);
+void therm_measure(struct therm_t * therm);
+void therm_free(struct therm_t * therm);
+
+#endif
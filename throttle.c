@@ -0,0 +1,304 @@
+#include "frame.h"
+#include "msr.h"
+#include "throttle.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct throttle_bit_t {
+	int status;
+	int log;
+	enum frame_flag flag;
+};
+
+static struct throttle_bit_t throttle_package_bits[] = {
+	{ 0, 1, FRAME_FLAG_THERMAL },
+	{ 2, 3, FRAME_FLAG_PROCHOT },
+	{ 4, 5, FRAME_FLAG_CRITICAL },
+	{ 6, 7, FRAME_FLAG_THRESHOLD },
+	{ 8, 9, FRAME_FLAG_THRESHOLD },
+	{ 10, 11, FRAME_FLAG_POWER_LIMIT },
+	{ -1, -1, 0 }
+};
+
+/* perf limit reasons keep the log of every status bit 16 bits above */
+static struct throttle_bit_t throttle_core_bits[] = {
+	{ 0, 16, FRAME_FLAG_PROCHOT },
+	{ 1, 17, FRAME_FLAG_THERMAL },
+	{ 4, 20, FRAME_FLAG_RSR },
+	{ 5, 21, FRAME_FLAG_RATL },
+	{ 6, 22, FRAME_FLAG_VR_THERMAL },
+	{ 7, 23, FRAME_FLAG_VR_TDC },
+	{ 8, 24, FRAME_FLAG_EDP },
+	{ 10, 26, FRAME_FLAG_PL1 },
+	{ 11, 27, FRAME_FLAG_PL2 },
+	{ 12, 28, FRAME_FLAG_MAX_TURBO },
+	{ 13, 29, FRAME_FLAG_TURBO_ATTENUATION },
+	{ -1, -1, 0 }
+};
+
+static struct throttle_bit_t throttle_graphics_bits[] = {
+	{ 0, 16, FRAME_FLAG_PROCHOT },
+	{ 1, 17, FRAME_FLAG_THERMAL },
+	{ 4, 20, FRAME_FLAG_GRAPHICS_DRIVER },
+	{ 5, 21, FRAME_FLAG_AUTONOMOUS },
+	{ 6, 22, FRAME_FLAG_VR_THERMAL },
+	{ 8, 24, FRAME_FLAG_EDP },
+	{ 9, 25, FRAME_FLAG_CORE_POWER },
+	{ 10, 26, FRAME_FLAG_PL1 },
+	{ 11, 27, FRAME_FLAG_PL2 },
+	{ 12, 28, FRAME_FLAG_MAX_TURBO },
+	{ 13, 29, FRAME_FLAG_TURBO_ATTENUATION },
+	{ -1, -1, 0 }
+};
+
+static struct throttle_bit_t throttle_ring_bits[] = {
+	{ 0, 16, FRAME_FLAG_PROCHOT },
+	{ 1, 17, FRAME_FLAG_THERMAL },
+	{ 6, 22, FRAME_FLAG_VR_THERMAL },
+	{ 8, 24, FRAME_FLAG_EDP },
+	{ 10, 26, FRAME_FLAG_PL1 },
+	{ 11, 27, FRAME_FLAG_PL2 },
+	{ 12, 28, FRAME_FLAG_MAX_TURBO },
+	{ 13, 29, FRAME_FLAG_TURBO_ATTENUATION },
+	{ -1, -1, 0 }
+};
+
+/* log bits are cleared by writing 0, so documented log bits which are not
+ * reported are written as 1 too, e.g. the HFI status bit 26 used by the
+ * kernel; reserved bits are never set, writing them can fail */
+#define THROTTLE_PACKAGE_EXTRA_LOG_MASK (1ULL << 26)
+
+static struct throttle_msr_t {
+	const char * name;
+	int msr_addr;
+	uint64_t extra_log_mask;
+	struct throttle_bit_t * bits;
+} throttle_msrs[] = {
+	{ "Package", MSR_ADDR_PACKAGE_THERM_STATUS,
+		THROTTLE_PACKAGE_EXTRA_LOG_MASK, throttle_package_bits },
+	{ "Core", MSR_ADDR_CORE_PERF_LIMIT_REASONS, 0, throttle_core_bits },
+	{ "Graphics", MSR_ADDR_GRAPHICS_PERF_LIMIT_REASONS, 0,
+		throttle_graphics_bits },
+	{ "Ring", MSR_ADDR_RING_PERF_LIMIT_REASONS, 0, throttle_ring_bits }
+};
+
+struct throttle_domain_ext_t {
+	int fd_msr;
+	bool writable;
+	int msr_addr;
+	uint64_t log_mask;
+	uint64_t write_mask;
+	struct throttle_bit_t * bits;
+};
+
+struct throttle_full_t {
+	struct throttle_t parent;
+	struct array_t * exts;
+	struct array_t * fds;
+};
+
+static void throttle_domain_free(void * pointer) {
+	struct throttle_domain_t * domain = pointer;
+	free(domain->name);
+}
+
+static void throttle_fd_free(void * pointer) {
+	close(* (int *) pointer);
+}
+
+void throttle_free(struct throttle_t * throttle) {
+	if (throttle) {
+		struct throttle_full_t * full = (struct throttle_full_t *) throttle;
+		if (full->parent.domains) {
+			array_free(full->parent.domains);
+		}
+		if (full->exts) {
+			array_free(full->exts);
+		}
+		if (full->fds) {
+			array_free(full->fds);
+		}
+		free(full);
+	}
+}
+
+static bool throttle_add(struct throttle_full_t * full, const char * name,
+	int fd, bool writable, struct throttle_msr_t * msr) {
+	struct throttle_domain_t * domain;
+	struct throttle_domain_ext_t * ext;
+	int length = strlen(name);
+	char * copy = malloc(length + 1);
+	int i;
+
+	if (!copy) {
+		return false;
+	}
+	memcpy(copy, name, length + 1);
+	domain = array_add(full->parent.domains);
+	if (!domain) {
+		free(copy);
+		return false;
+	}
+	domain->name = copy;
+	domain->active = 0;
+	domain->logged = 0;
+
+	ext = array_add(full->exts);
+	if (!ext) {
+		full->parent.domains->count--;
+		free(copy);
+		return false;
+	}
+	ext->fd_msr = fd;
+	ext->writable = writable;
+	ext->msr_addr = msr->msr_addr;
+	ext->log_mask = 0;
+	ext->bits = msr->bits;
+	for (i = 0; msr->bits[i].status >= 0; i++) {
+		ext->log_mask |= 1ULL << msr->bits[i].log;
+	}
+	ext->write_mask = msr->extra_log_mask | ext->log_mask;
+	return true;
+}
+
+static const char * throttle_name(struct topology_t * topology,
+	struct topology_cpu_t * cpu, struct throttle_msr_t * msr, char * buf) {
+	if (topology->package_count > 1) {
+		sprintf(buf, "%s %d", msr->name, cpu->package);
+	} else {
+		strcpy(buf, msr->name);
+	}
+	return buf;
+}
+
+struct throttle_t * throttle_init(struct topology_t * topology,
+	struct filter_t * filter) {
+	struct throttle_full_t * full;
+	bool filtered = false;
+	char buf[40];
+	int i;
+
+	full = malloc(sizeof(struct throttle_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.domains = array_new(sizeof(struct throttle_domain_t),
+		throttle_domain_free);
+	full->exts = array_new(sizeof(struct throttle_domain_ext_t), NULL);
+	full->fds = array_new(sizeof(int), throttle_fd_free);
+	if (!full->parent.domains || !full->exts || !full->fds) {
+		throttle_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+
+	for (i = 0; topology && i < topology->cpus->count; i++) {
+		struct topology_cpu_t * cpu = array_get(topology->cpus, i);
+		bool writable = false;
+		bool selected;
+		unsigned int j;
+		int fd;
+
+		if (!cpu->first_in_package) {
+			continue;
+		}
+		selected = false;
+		for (j = 0; j < ARRAY_SIZE(throttle_msrs); j++) {
+			selected |= filter_match(filter, throttle_name(topology, cpu,
+				&throttle_msrs[j], buf));
+		}
+		if (!selected) {
+			filtered = true;
+			continue;
+		}
+		/* log bits can be cleared only through a writable descriptor */
+		fd = msr_open(cpu->cpu, true);
+		if (fd >= 0) {
+			int * item = array_add(full->fds);
+			if (!item) {
+				close(fd);
+				throttle_free(&full->parent);
+				fprintf(stderr, "No enough memory\n");
+				return NULL;
+			}
+			*item = fd;
+			writable = true;
+		} else {
+			fd = topology_msr(cpu);
+			if (fd < 0) {
+				continue;
+			}
+		}
+
+		for (j = 0; j < ARRAY_SIZE(throttle_msrs); j++) {
+			uint64_t value;
+			if (!filter_match(filter, throttle_name(topology, cpu,
+				&throttle_msrs[j], buf))) {
+				filtered = true;
+				continue;
+			}
+			if (!msr_rd(fd, throttle_msrs[j].msr_addr, value)) {
+				continue;
+			}
+			if (!throttle_add(full, buf, fd, writable, &throttle_msrs[j])) {
+				throttle_free(&full->parent);
+				fprintf(stderr, "No enough memory\n");
+				return NULL;
+			}
+		}
+	}
+
+	if (full->parent.domains->count == 0) {
+		throttle_free(&full->parent);
+		if (!filtered) {
+			fprintf(stderr, "Failed to read throttle reasons MSR\n");
+		}
+		return NULL;
+	}
+	array_shrink(full->parent.domains);
+	array_shrink(full->exts);
+	return &full->parent;
+}
+
+void throttle_measure(struct throttle_t * throttle) {
+	if (throttle) {
+		struct throttle_full_t * full = (struct throttle_full_t *) throttle;
+		int i, j;
+
+		for (i = 0; i < full->parent.domains->count; i++) {
+			struct throttle_domain_t * domain = array_get(full->parent.domains, i);
+			struct throttle_domain_ext_t * ext = array_get(full->exts, i);
+			uint64_t value;
+			uint64_t logged;
+
+			domain->active = 0;
+			domain->logged = 0;
+			if (!msr_rd(ext->fd_msr, ext->msr_addr, value)) {
+				continue;
+			}
+			for (j = 0; ext->bits[j].status >= 0; j++) {
+				if ((value >> ext->bits[j].status) & 0x1) {
+					domain->active |= 1 << ext->bits[j].flag;
+				}
+				if ((value >> ext->bits[j].log) & 0x1) {
+					domain->logged |= 1 << ext->bits[j].flag;
+				}
+			}
+
+			logged = value & ext->log_mask;
+			if (logged && ext->writable) {
+				/* log bits are cleared by writing 0, writing 1 keeps them,
+				 * so only the observed bits are cleared */
+				uint64_t clear = ext->write_mask & ~logged;
+				if (!msr_wr(ext->fd_msr, ext->msr_addr, clear)) {
+					ext->writable = false;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef __THROTTLE_H__
+#define __THROTTLE_H__
+
+#include "filter.h"
+#include "topology.h"
+#include "util.h"
+
+/* Active and logged reasons are masks of frame_flag bits. */
+struct throttle_domain_t {
+	char * name;
+	uint32_t active;
+	uint32_t logged;
+};
+
+struct throttle_t {
+	struct array_t * domains;
+};
+
+struct throttle_t * throttle_init(struct topology_t * topology,
+	struct filter_t * filter);
+void throttle_measure(struct throttle_t * throttle);
+void throttle_free(struct throttle_t * throttle);
+
+#endif
@@ -0,0 +1,161 @@
+#include "msr.h"
+#include "topology.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DIR_CPU "/sys/devices/system/cpu"
+
+static int read_topology(int cpu, const char * name) {
+	char buf[PATH_MAX];
+	int value = -1;
+	int fd;
+
+	snprintf(buf, sizeof(buf), "%s" DIR_CPU "/cpu%d/topology/%s",
+		get_root(), cpu, name);
+	fd = open(buf, O_RDONLY);
+	if (fd >= 0) {
+		int size = read(fd, buf, 20);
+		if (size > 0) {
+			buf[size] = '\0';
+			value = atoi(buf);
+		}
+		close(fd);
+	}
+	return value;
+}
+
+static void topology_cpu_free(void * pointer) {
+	struct topology_cpu_t * cpu = pointer;
+	if (cpu->fd_msr >= 0) {
+		close(cpu->fd_msr);
+	}
+}
+
+static int topology_cpu_compare(const void * a, const void * b) {
+	return ((const struct topology_cpu_t *) a)->cpu -
+		((const struct topology_cpu_t *) b)->cpu;
+}
+
+struct topology_t * topology_init() {
+	char buf[PATH_MAX];
+	struct topology_t * topology;
+	struct dirent * dirent;
+	DIR * dir;
+	int i, j;
+
+	topology = malloc(sizeof(struct topology_t));
+	if (topology) {
+		topology->cpus = array_new(sizeof(struct topology_cpu_t),
+			topology_cpu_free);
+	}
+	if (!topology || !topology->cpus) {
+		free(topology);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	topology->package_count = 0;
+
+	snprintf(buf, sizeof(buf), "%s" DIR_CPU, get_root());
+	dir = opendir(buf);
+	while (dir && (dirent = readdir(dir))) {
+		char * tmp = NULL;
+		int index;
+		int package;
+		struct topology_cpu_t * cpu;
+
+		if (strncmp(dirent->d_name, "cpu", 3) || !dirent->d_name[3]) {
+			continue;
+		}
+		index = (int) strtol(&dirent->d_name[3], &tmp, 10);
+		if (!tmp || tmp[0]) {
+			continue;
+		}
+		/* offline CPUs have no topology */
+		package = read_topology(index, "physical_package_id");
+		if (package < 0) {
+			continue;
+		}
+		cpu = array_add(topology->cpus);
+		if (!cpu) {
+			closedir(dir);
+			topology_free(topology);
+			fprintf(stderr, "No enough memory\n");
+			return NULL;
+		}
+		cpu->cpu = index;
+		cpu->package = package;
+		cpu->core = read_topology(index, "core_id");
+		cpu->fd_msr = -1;
+	}
+	if (dir) {
+		closedir(dir);
+	}
+
+	if (topology->cpus->count == 0) {
+		/* topology is not exposed, assume a single CPU */
+		struct topology_cpu_t * cpu = array_add(topology->cpus);
+		if (!cpu) {
+			topology_free(topology);
+			fprintf(stderr, "No enough memory\n");
+			return NULL;
+		}
+		cpu->cpu = 0;
+		cpu->package = 0;
+		cpu->core = 0;
+		cpu->fd_msr = -1;
+	}
+	array_shrink(topology->cpus);
+	qsort(array_get(topology->cpus, 0), topology->cpus->count,
+		sizeof(struct topology_cpu_t), topology_cpu_compare);
+
+	for (i = 0; i < topology->cpus->count; i++) {
+		struct topology_cpu_t * cpu = array_get(topology->cpus, i);
+		cpu->first_in_core = true;
+		cpu->first_in_package = true;
+		for (j = 0; j < i; j++) {
+			struct topology_cpu_t * prev = array_get(topology->cpus, j);
+			if (prev->package == cpu->package) {
+				cpu->first_in_package = false;
+				if (prev->core == cpu->core) {
+					cpu->first_in_core = false;
+				}
+			}
+		}
+		if (cpu->first_in_package) {
+			topology->package_count++;
+		}
+	}
+
+	return topology;
+}
+
+int topology_msr(struct topology_cpu_t * cpu) {
+	if (cpu->fd_msr < 0) {
+		cpu->fd_msr = msr_open(cpu->cpu, false);
+	}
+	return cpu->fd_msr;
+}
+
+/* Core ids are unique only within a package. */
+int topology_core_name(struct topology_t * topology,
+	struct topology_cpu_t * cpu, char * buf) {
+	if (topology->package_count > 1) {
+		return sprintf(buf, "Package %d Core %d", cpu->package, cpu->core);
+	} else {
+		return sprintf(buf, "Core %d", cpu->core);
+	}
+}
+
+void topology_free(struct topology_t * topology) {
+	if (topology) {
+		array_free(topology->cpus);
+		free(topology);
+	}
+}
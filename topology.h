@@ -0,0 +1,26 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include "util.h"
+
+struct topology_cpu_t {
+	int cpu;
+	int package;
+	int core;
+	bool first_in_core;
+	bool first_in_package;
+	int fd_msr;
+};
+
+struct topology_t {
+	struct array_t * cpus;
+	int package_count;
+};
+
+struct topology_t * topology_init();
+int topology_msr(struct topology_cpu_t * cpu);
+int topology_core_name(struct topology_t * topology,
+	struct topology_cpu_t * cpu, char * buf);
+void topology_free(struct topology_t * topology);
+
+#endif
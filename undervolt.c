@@ -1,51 +1,39 @@
+#include "msr.h"
 #include "undervolt.h"
 
 #include <errno.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
-#ifdef IS_FREEBSD
-#include <sys/cpuctl.h>
-#include <sys/ioccom.h>
-#endif
 #include <unistd.h>
 
 #define absf(x) ((x) < 0 ? -(x) : (x))
 
-#ifdef IS_FREEBSD
+#define rd(p, a, t) msr_rd(p->fd_msr, (a), t)
+#define wr(p, a, t) msr_wr(p->fd_msr, (a), t)
 
-static inline bool cpuctl_rd(int fd, int a, uint64_t * t) {
-	cpuctl_msr_args_t args;
-	args.msr = a;
-	if (ioctl(fd, CPUCTL_RDMSR, &args) == -1) {
-		return false;
-	}
-	*t = args.data;
-	return true;
-}
+#define PREFIXSZ 20
 
-static inline bool cpuctl_wr(int fd, int a, uint64_t * t) {
-	cpuctl_msr_args_t args;
-	args.msr = a;
-	args.data = *t;
-	return ioctl(fd, CPUCTL_WRMSR, &args) != -1;
+/* Output lines are prefixed with package when there are many of them. */
+static const char * package_prefix(struct config_t * config,
+	struct msr_package_t * package, char * buf) {
+	if (config->packages->count > 1) {
+		sprintf(buf, "Package %d: ", package->package);
+		return buf;
+	} else {
+		return "";
+	}
 }
 
-#define rd(c, a, t) (cpuctl_rd(c->fd_msr, (a), &(t)))
-#define wr(c, a, t) (cpuctl_wr(c->fd_msr, (a), &(t)))
-
-#else
-
-#define rd(c, a, t) (pread(c->fd_msr, &(t), 8, (a)) == 8)
-#define wr(c, a, t) (pwrite(c->fd_msr, &(t), 8, (a)) == 8)
-
-#endif
-
-bool undervolt(struct config_t * config, bool * nl, bool write) {
+static bool undervolt_package(struct config_t * config,
+	struct msr_package_t * package, bool * nl, bool write) {
+	char prefix[PREFIXSZ];
 	bool success = true;
 	bool nll = false;
 	int i;
 
+	package_prefix(config, package, prefix);
+
 	for (i = 0; config->undervolts && i < config->undervolts->count; i++) {
 		struct undervolt_t * undervolt = array_get(config->undervolts, i);
 
@@ -57,10 +45,10 @@ bool undervolt(struct config_t * config, bool * nl, bool write) {
 		uint64_t wrval = rdval | 0x100000000 | uvint;
 
 		bool write_success = !write ||
-			wr(config, MSR_ADDR_VOLTAGE, wrval);
+			wr(package, MSR_ADDR_VOLTAGE, wrval);
 		bool read_success = write_success &&
-			wr(config, MSR_ADDR_VOLTAGE, rdval) &&
-			rd(config, MSR_ADDR_VOLTAGE, rdval);
+			wr(package, MSR_ADDR_VOLTAGE, rdval) &&
+			rd(package, MSR_ADDR_VOLTAGE, rdval);
 
 		const char * errstr = NULL;
 		if (!write_success || !read_success) {
@@ -72,17 +60,31 @@ bool undervolt(struct config_t * config, bool * nl, bool write) {
 		NEW_LINE(nl, nll);
 		if (errstr) {
 			success = false;
-			printf("%s (%d): %s\n", undervolt->title, undervolt->index, errstr);
+			printf("%s%s (%d): %s\n", package_prefix(config, package, prefix),
+				undervolt->title, undervolt->index, errstr);
 		} else if (nl) {
 			float val = ((mask - (rdval >> 21)) & (mask - 1)) / 1.024f;
-			printf("%s (%d): -%.02f mV\n", undervolt->title,
-				undervolt->index, val);
+			printf("%s%s (%d): -%.02f mV\n",
+				package_prefix(config, package, prefix),
+				undervolt->title, undervolt->index, val);
 		}
 	}
 
 	return success;
 }
 
+bool undervolt(struct config_t * config, bool * nl, bool write) {
+	bool success = true;
+	int i;
+
+	for (i = 0; config->undervolts && config->packages &&
+		i < config->packages->count; i++) {
+		success &= undervolt_package(config, array_get(config->packages, i),
+			nl, write);
+	}
+	return success;
+}
+
 static float power_to_seconds(int value, int time_unit) {
 	float multiplier = 1 + ((value >> 6) & 0x3) / 4.f;
 	int exponent = (value >> 1) & 0x1f;
@@ -117,12 +119,18 @@ static int power_from_seconds(float seconds, int time_unit) {
 	}
 }
 
-bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
+static bool power_limit_package(struct config_t * config,
+	struct msr_package_t * package, int index, bool * nl, bool write) {
+	char prefix[PREFIXSZ];
 	bool nll = false;
 	struct power_limit_t * power = &config->power[index];
 	struct power_domain_t * domain = &power_domains[index];
 	if (power->apply) {
 		void * mem = NULL;
+		/* memory mapped limits exist only once in the system */
+		bool use_mem = package == array_get(config->packages, 0) &&
+			domain->mem_addr != 0;
+		package_prefix(config, package, prefix);
 		if (power->mem != NULL) {
 			mem = power->mem + (domain->mem_addr & MAP_MASK);
 		}
@@ -131,10 +139,10 @@ bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
 		uint64_t msr_limit;
 		uint64_t mem_limit;
 		uint64_t units;
-		if (domain->msr_addr == 0 || rd(config, domain->msr_addr, msr_limit)) {
-			if (domain->mem_addr == 0 ||
+		if (domain->msr_addr == 0 || rd(package, domain->msr_addr, msr_limit)) {
+			if (!use_mem ||
 				safe_rw(mem, &mem_limit, false)) {
-				if (!rd(config, MSR_ADDR_UNITS, units)) {
+				if (!rd(package, MSR_ADDR_UNITS, units)) {
 					errstr = strerror(errno);
 				}
 			} else {
@@ -147,18 +155,18 @@ bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
 		if (!errstr) {
 			if (domain->msr_addr == 0) {
 				msr_limit = mem_limit;
-			} else if (domain->mem_addr == 0) {
+			} else if (!use_mem) {
 				mem_limit = msr_limit;
 			}
-			if (domain->msr_addr == 0 && domain->mem_addr == 0) {
+			if (domain->msr_addr == 0 && !use_mem) {
 				errstr = "No method available";
 			}
 		}
 
 		if (errstr) {
 			NEW_LINE(nl, nll);
-			printf("Failed to read %s power values: %s\n",
-				domain->name, errstr);
+			printf("%sFailed to read %s power values: %s\n",
+				prefix, domain->name, errstr);
 		} else {
 			int power_unit = (int) (exp2f(units & 0xf) + 0.5f);
 			int time_unit = (int) (exp2f((units >> 16) & 0xf) + 0.5f);
@@ -189,8 +197,8 @@ bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
 				value |= (power->short_term.enabled ? 1L << 47 : 0) |
 					(power->long_term.enabled ? 1L << 15 : 0);
 				if (domain->msr_addr == 0 ||
-					wr(config, domain->msr_addr, value)) {
-					if (domain->mem_addr == 0 ||
+					wr(package, domain->msr_addr, value)) {
+					if (!use_mem ||
 						safe_rw(mem, &value, true)) {
 						msr_limit = value;
 						mem_limit = value;
@@ -202,16 +210,18 @@ bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
 				}
 			} else if (msr_limit != mem_limit) {
 				NEW_LINE(nl, nll);
-				printf("Warning: MSR and memory values are not equal\n");
+				printf("%sWarning: MSR and memory values are not equal\n",
+					prefix);
 			}
 
 			NEW_LINE(nl, nll);
 			if (errstr) {
-				printf("Failed to write %s power values: %s\n",
-					domain->name, errstr);
+				printf("%sFailed to write %s power values: %s\n",
+					prefix, domain->name, errstr);
 			} else if (nl) {
 				if ((msr_limit >> 63) & 0x1) {
-					printf("Warning: %s power limit is locked\n", domain->name);
+					printf("%sWarning: %s power limit is locked\n",
+						prefix, domain->name);
 				}
 				int short_term = ((msr_limit >> 32) & 0x7fff) / power_unit;
 				int long_term = (msr_limit & 0x7fff) / power_unit;
@@ -221,11 +231,11 @@ bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
 					time_unit);
 				float long_term_window = power_to_seconds(msr_limit >> 16,
 					time_unit);
-				printf("Short term %s power: %d W, %.03f s, %s\n",
-					domain->name, short_term, short_term_window,
+				printf("%sShort term %s power: %d W, %.03f s, %s\n",
+					prefix, domain->name, short_term, short_term_window,
 					(short_term_enabled ? "enabled" : "disabled"));
-				printf("Long term %s power: %d W, %.03f s, %s\n",
-					domain->name, long_term, long_term_window,
+				printf("%sLong term %s power: %d W, %.03f s, %s\n",
+					prefix, domain->name, long_term, long_term_window,
 					(long_term_enabled ? "enabled" : "disabled"));
 			}
 		}
@@ -236,18 +246,32 @@ bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
 	}
 }
 
-bool tjoffset(struct config_t * config, bool * nl, bool write) {
+bool power_limit(struct config_t * config, int index, bool * nl, bool write) {
+	bool success = true;
+	int i;
+
+	for (i = 0; config->power[index].apply && config->packages &&
+		i < config->packages->count; i++) {
+		success &= power_limit_package(config, array_get(config->packages, i),
+			index, nl, write);
+	}
+	return success;
+}
+
+static bool tjoffset_package(struct config_t * config,
+	struct msr_package_t * package, bool * nl, bool write) {
+	char prefix[PREFIXSZ];
 	bool nll = false;
 	if (config->tjoffset_apply) {
 		const char * errstr = NULL;
 
 		if (write) {
 			uint64_t limit;
-			if (rd(config, MSR_ADDR_TEMPERATURE, limit)) {
+			if (rd(package, MSR_ADDR_TEMPERATURE, limit)) {
 				uint64_t offset = absf(config->tjoffset);
 				offset = offset > 0x3f ? 0x3f : offset;
 				limit = (limit & 0xffffffffc0ffffff) | (offset << 24);
-				if (!wr(config, MSR_ADDR_TEMPERATURE, limit)) {
+				if (!wr(package, MSR_ADDR_TEMPERATURE, limit)) {
 					errstr = strerror(errno);
 				}
 			} else {
@@ -255,16 +279,18 @@ bool tjoffset(struct config_t * config, bool * nl, bool write) {
 			}
 		}
 
+		package_prefix(config, package, prefix);
 		NEW_LINE(nl, nll);
 		if (errstr) {
-			printf("Failed to write temperature offset: %s\n", errstr);
+			printf("%sFailed to write temperature offset: %s\n", prefix, errstr);
 		} else if (nl) {
 			uint64_t limit;
-			if (rd(config, MSR_ADDR_TEMPERATURE, limit)) {
+			if (rd(package, MSR_ADDR_TEMPERATURE, limit)) {
 				int offset = (limit & 0x3f000000) >> 24;
-				printf("Critical offset: -%d°C\n", offset);
+				printf("%sCritical offset: -%d°C\n", prefix, offset);
 			} else {
-				printf("Failed to read temperature offset: %s\n", errstr);
+				printf("%sFailed to read temperature offset: %s\n", prefix,
+					strerror(errno));
 			}
 		}
 
@@ -273,3 +299,15 @@ bool tjoffset(struct config_t * config, bool * nl, bool write) {
 		return true;
 	}
 }
+
+bool tjoffset(struct config_t * config, bool * nl, bool write) {
+	bool success = true;
+	int i;
+
+	for (i = 0; config->tjoffset_apply && config->packages &&
+		i < config->packages->count; i++) {
+		success &= tjoffset_package(config, array_get(config->packages, i),
+			nl, write);
+	}
+	return success;
+}
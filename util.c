@@ -1,5 +1,6 @@
 #include "util.h"
 
+#include <errno.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -9,6 +10,16 @@ bool strn_eq_const(const char * str, const char * cstr, size_t n) {
 	return n >= strlen(cstr) && !strncmp(str, cstr, n);
 }
 
+static const char * root_dir = "";
+
+void set_root(const char * root) {
+	root_dir = root ? root : "";
+}
+
+const char * get_root() {
+	return root_dir;
+}
+
 static jmp_buf sigsegv_handler_jmp_buf;
 
 static void sigsegv_handler(UNUSED int sig) {
@@ -34,6 +45,46 @@ bool safe_rw(uint64_t * addr, uint64_t * data, bool write) {
 	return success;
 }
 
+static int64_t timespec_ns(struct timespec * ts) {
+	return (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+void ticker_init(struct ticker_t * ticker, int64_t interval_ns) {
+	clock_gettime(CLOCK_MONOTONIC, &ticker->next);
+	ticker_set_interval(ticker, interval_ns);
+	ticker->pending = false;
+	ticker->missed = 0;
+}
+
+void ticker_set_interval(struct ticker_t * ticker, int64_t interval_ns) {
+	ticker->interval = interval_ns > 0 ? interval_ns : 1;
+}
+
+bool ticker_wait(struct ticker_t * ticker) {
+	if (!ticker->pending) {
+		struct timespec now;
+		int64_t next = timespec_ns(&ticker->next) + ticker->interval;
+		int64_t late;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late = timespec_ns(&now) - next;
+		if (late > 0) {
+			/* keep the grid, skip the deadlines which already passed */
+			int64_t skip = late / ticker->interval + 1;
+			next += skip * ticker->interval;
+			ticker->missed += skip;
+		}
+		ticker->next.tv_sec = next / 1000000000;
+		ticker->next.tv_nsec = next % 1000000000;
+		ticker->pending = true;
+	}
+	if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+		&ticker->next, NULL) == EINTR) {
+		return false;
+	}
+	ticker->pending = false;
+	return true;
+}
+
 struct array_full_t {
 	struct array_t parent;
 	int item_size;
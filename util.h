@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <time.h>
 
 #if defined(__GNUC__)
 #define UNUSED __attribute__((unused))
@@ -46,8 +47,22 @@ _Pragma("GCC diagnostic pop")
 
 bool strn_eq_const(const char * str, const char * cstr, size_t n);
 
+void set_root(const char * root);
+const char * get_root();
+
 bool safe_rw(uint64_t * addr, uint64_t * data, bool write);
 
+struct ticker_t {
+	struct timespec next;
+	int64_t interval;
+	bool pending;
+	long missed;
+};
+
+void ticker_init(struct ticker_t * ticker, int64_t interval_ns);
+void ticker_set_interval(struct ticker_t * ticker, int64_t interval_ns);
+bool ticker_wait(struct ticker_t * ticker);
+
 struct array_t {
 	int count;
 };
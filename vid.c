@@ -0,0 +1,121 @@
+#include "msr.h"
+#include "vid.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct vid_full_t {
+	struct vid_t parent;
+	struct array_t * fds;
+};
+
+static void vid_core_free(void * pointer) {
+	struct vid_core_t * core = pointer;
+	free(core->name);
+}
+
+void vid_free(struct vid_t * vid) {
+	if (vid) {
+		struct vid_full_t * full = (struct vid_full_t *) vid;
+		if (full->parent.cores) {
+			array_free(full->parent.cores);
+		}
+		if (full->fds) {
+			array_free(full->fds);
+		}
+		free(full);
+	}
+}
+
+struct vid_t * vid_init(struct topology_t * topology,
+	struct filter_t * filter) {
+	struct vid_full_t * full;
+	bool filtered = false;
+	char buf[40];
+	int i;
+
+	full = malloc(sizeof(struct vid_full_t));
+	if (!full) {
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+	full->parent.cores = array_new(sizeof(struct vid_core_t), vid_core_free);
+	full->fds = array_new(sizeof(int), NULL);
+	if (!full->parent.cores || !full->fds) {
+		vid_free(&full->parent);
+		fprintf(stderr, "No enough memory\n");
+		return NULL;
+	}
+
+	for (i = 0; topology && i < topology->cpus->count; i++) {
+		struct topology_cpu_t * cpu = array_get(topology->cpus, i);
+		struct vid_core_t * core;
+		uint64_t value;
+		int length;
+		int * fd;
+
+		if (!cpu->first_in_core) {
+			continue;
+		}
+		length = topology_core_name(topology, cpu, buf);
+		if (!filter_match(filter, buf)) {
+			filtered = true;
+			continue;
+		}
+		if (topology_msr(cpu) < 0 ||
+			!msr_rd(cpu->fd_msr, MSR_ADDR_PERF_STATUS, value)) {
+			continue;
+		}
+		core = array_add(full->parent.cores);
+		if (core) {
+			core->name = malloc(length + 1);
+			if (!core->name) {
+				full->parent.cores->count--;
+				core = NULL;
+			}
+		}
+		fd = core ? array_add(full->fds) : NULL;
+		if (!fd) {
+			if (core) {
+				full->parent.cores->count--;
+				free(core->name);
+			}
+			vid_free(&full->parent);
+			fprintf(stderr, "No enough memory\n");
+			return NULL;
+		}
+		memcpy(core->name, buf, length + 1);
+		core->voltage = NAN;
+		*fd = cpu->fd_msr;
+	}
+
+	if (full->parent.cores->count == 0) {
+		vid_free(&full->parent);
+		if (!filtered) {
+			fprintf(stderr, "Failed to read performance status MSR\n");
+		}
+		return NULL;
+	}
+	array_shrink(full->parent.cores);
+	array_shrink(full->fds);
+	return &full->parent;
+}
+
+void vid_measure(struct vid_t * vid) {
+	if (vid) {
+		struct vid_full_t * full = (struct vid_full_t *) vid;
+		int i;
+
+		for (i = 0; i < full->parent.cores->count; i++) {
+			struct vid_core_t * core = array_get(full->parent.cores, i);
+			int * fd = array_get(full->fds, i);
+			uint64_t value;
+			/* bits 47:32 hold the core voltage in 1 / 2 ^ 13 V units */
+			core->voltage = msr_rd(*fd, MSR_ADDR_PERF_STATUS, value)
+				? ((value >> 32) & 0xffff) / 8192.f : NAN;
+		}
+	}
+}
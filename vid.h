@@ -0,0 +1,22 @@
+#ifndef __VID_H__
+#define __VID_H__
+
+#include "filter.h"
+#include "topology.h"
+#include "util.h"
+
+struct vid_core_t {
+	char * name;
+	float voltage;
+};
+
+struct vid_t {
+	struct array_t * cores;
+};
+
+struct vid_t * vid_init(struct topology_t * topology,
+	struct filter_t * filter);
+void vid_measure(struct vid_t * vid);
+void vid_free(struct vid_t * vid);
+
+#endif